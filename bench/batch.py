@@ -0,0 +1,60 @@
+"""Measures the per-record time of compress_many() and decompress_many() on small records.
+
+Usage: python bench/batch.py [--sizes N,N,...] [--count N] [--threads N] [--repeat N]
+
+Each batch is compared with calling compress() and decompress() once per record. The
+batched functions are measured on a single thread and with --threads threads.
+"""
+
+import argparse
+import random
+
+from common import best_time, make_words
+from ncompress import compress, compress_many, decompress, decompress_many
+
+
+def make_records(size, count):
+    rng = random.Random(size)
+    words = make_words(rng, 2000)
+    records = []
+    for _ in range(count):
+        out = bytearray()
+        n = rng.randint(size // 2, size * 3 // 2)
+        while len(out) < n:
+            out += rng.choice(words) + b" "
+        records.append(bytes(out[:n]))
+    return records
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--sizes", default="30,100,300,1000",
+                        help="comma-separated average record sizes in bytes")
+    parser.add_argument("--count", type=int, default=100000, help="records per batch")
+    parser.add_argument("--threads", type=int, default=0, help="threads, 0 for all cores")
+    parser.add_argument("--repeat", type=int, default=5, help="runs per measurement, best is kept")
+    args = parser.parse_args()
+
+    print(f"{'size':>8}{'compress us':>14}{'_many us':>10}{'threaded us':>13}"
+          f"{'decompress us':>16}{'_many us':>10}{'threaded us':>13}")
+    for size in map(int, args.sizes.split(",")):
+        records = make_records(size, args.count)
+        data, offsets = compress_many(records)
+        compressed = [data[offsets[i]:offsets[i + 1]] for i in range(len(records))]
+        assert decompress_many(data, offsets)[0] == b"".join(records)
+
+        times = [
+            best_time(lambda: [compress(r) for r in records], args.repeat),
+            best_time(lambda: compress_many(records), args.repeat),
+            best_time(lambda: compress_many(records, threads=args.threads), args.repeat),
+            best_time(lambda: [decompress(c) for c in compressed], args.repeat),
+            best_time(lambda: decompress_many(compressed), args.repeat),
+            best_time(lambda: decompress_many(compressed, threads=args.threads), args.repeat),
+        ]
+        us = [t / args.count * 1e6 for t in times]
+        print(f"{size:>8}{us[0]:>14.2f}{us[1]:>10.2f}{us[2]:>13.2f}"
+              f"{us[3]:>16.2f}{us[4]:>10.2f}{us[5]:>13.2f}")
+
+
+if __name__ == "__main__":
+    main()
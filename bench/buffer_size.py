@@ -0,0 +1,77 @@
+"""Measures compress() and decompress() between files for a range of buffer sizes.
+
+Usage: python bench/buffer_size.py [--size MB] [--repeat N] [--dir DIR] [FILE]
+
+The input is read from and the output written to files in DIR (the system temporary
+directory by default), so that the cost of the read() and write() calls on the file
+objects is included. compress_file() and decompress_file(), which bypass the file objects,
+are measured last for comparison. Without a file, a synthetic text corpus is used.
+"""
+
+import argparse
+import os
+import tempfile
+import time
+
+from common import make_text
+from ncompress import compress, compress_file, decompress, decompress_file
+
+
+def best_file_time(func, src, dst, repeat):
+    """Like common.best_time(), with src and dst opened for each run outside the timing."""
+    best = float("inf")
+    for _ in range(repeat):
+        with open(src, "rb") as fin, open(dst, "wb") as fout:
+            start = time.perf_counter()
+            func(fin, fout)
+            best = min(best, time.perf_counter() - start)
+    return best
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("file", nargs="?", help="file to use as the input")
+    parser.add_argument("--size", type=float, default=32.0, help="synthetic input size in MB")
+    parser.add_argument("--repeat", type=int, default=5, help="runs per measurement, best is kept")
+    parser.add_argument("--dir", help="directory for the temporary files")
+    args = parser.parse_args()
+
+    if args.file:
+        with open(args.file, "rb") as f:
+            data = f.read()
+    else:
+        data = make_text(int(args.size * 1e6), seed=0)
+
+    mb = len(data) / 1e6
+    with tempfile.TemporaryDirectory(dir=args.dir) as tmp:
+        raw = os.path.join(tmp, "raw")
+        packed = os.path.join(tmp, "raw.Z")
+        out = os.path.join(tmp, "out")
+        with open(raw, "wb") as f:
+            f.write(data)
+        with open(packed, "wb") as f:
+            f.write(compress(data))
+
+        print(f"{'buffer':>10}{'calls':>10}{'compress MB/s':>15}{'decompress MB/s':>17}")
+        for buffer_kb in [1, 4, 16, 64, 256, 1024]:
+            buffer_size = buffer_kb << 10
+            t_comp = best_file_time(
+                lambda fin, fout: compress(fin, fout, buffer_size=buffer_size),
+                raw, out, args.repeat)
+            t_decomp = best_file_time(
+                lambda fin, fout: decompress(fin, fout, buffer_size=buffer_size),
+                packed, out, args.repeat)
+            with open(out, "rb") as f:
+                assert f.read() == data
+            calls = (len(data) + buffer_size - 1) // buffer_size
+            print(f"{buffer_kb:>8}kB{calls:>10}{mb / t_comp:>15.1f}{mb / t_decomp:>17.1f}")
+
+        t_comp = best_file_time(lambda fin, fout: compress_file(raw, out), raw, out,
+                                args.repeat)
+        t_decomp = best_file_time(lambda fin, fout: decompress_file(packed, out), packed, out,
+                                  args.repeat)
+        print(f"{'file API':>10}{'':>10}{mb / t_comp:>15.1f}{mb / t_decomp:>17.1f}")
+
+
+if __name__ == "__main__":
+    main()
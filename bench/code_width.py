@@ -0,0 +1,42 @@
+"""Measures compress() and decompress() speed in codes per second for each max_bits.
+
+Usage: python bench/code_width.py [--size MB] [--repeat N] [FILE]
+
+Without a file, random bytes are used, which produce the most codes per input byte.
+The number of codes is estimated as the compressed size in bits divided by max_bits.
+"""
+
+import argparse
+import os
+
+from common import best_time
+from ncompress import compress, decompress_into
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("file", nargs="?", help="file to use as the input")
+    parser.add_argument("--size", type=float, default=8.0, help="random input size in MB")
+    parser.add_argument("--repeat", type=int, default=7, help="runs per measurement, best is kept")
+    args = parser.parse_args()
+
+    if args.file:
+        with open(args.file, "rb") as f:
+            data = f.read()
+    else:
+        data = os.urandom(int(args.size * 1e6))
+
+    out = bytearray(len(data))
+    print(f"{'bits':>6}{'ratio':>8}{'compress Mc/s':>16}{'decompress Mc/s':>18}")
+    for bits in range(9, 17):
+        compressed = compress(data, max_bits=bits)
+        codes = len(compressed) * 8 / bits
+        t_comp = best_time(lambda: compress(data, max_bits=bits), args.repeat)
+        t_decomp = best_time(lambda: decompress_into(compressed, out), args.repeat)
+        assert out == data
+        print(f"{bits:>6}{len(data) / len(compressed):>8.2f}"
+              f"{codes / t_comp / 1e6:>16.1f}{codes / t_decomp / 1e6:>18.1f}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,63 @@
+"""Timing and corpus helpers shared by the benchmark scripts.
+
+The text, binary and random corpora are the ones of the ncompress_bench C++ target. The
+scripts import this module as `common`, which works both when they are run directly and
+under pytest, as both put bench/ on sys.path.
+"""
+
+import random
+import struct
+import time
+
+
+def best_time(func, repeat):
+    """Runs func() repeat times and returns the shortest time in seconds."""
+    best = float("inf")
+    for _ in range(repeat):
+        start = time.perf_counter()
+        func()
+        best = min(best, time.perf_counter() - start)
+    return best
+
+
+def make_words(rng, count, min_len=2, max_len=10):
+    """Returns count random lowercase words."""
+    letters = b"abcdefghijklmnopqrstuvwxyz"
+    return [bytes(rng.choice(letters) for _ in range(rng.randint(min_len, max_len)))
+            for _ in range(count)]
+
+
+def make_text(size, seed=1, vocabulary=3000):
+    """Text of words from a vocabulary, the first ones more frequent, with a line break
+    after about every 12th word."""
+    rng = random.Random(seed)
+    words = make_words(rng, vocabulary)
+    out = bytearray()
+    while len(out) < size:
+        out += words[min(rng.randrange(vocabulary), rng.randrange(vocabulary))]
+        out += b"\n" if rng.randrange(12) == 0 else b" "
+    return bytes(out[:size])
+
+
+def make_plain_text(size, seed=0, vocabulary=2000):
+    """Words picked uniformly from a vocabulary, separated by spaces."""
+    rng = random.Random(seed)
+    words = make_words(rng, vocabulary)
+    out = bytearray()
+    while len(out) < size:
+        out += rng.choice(words) + b" "
+    return bytes(out[:size])
+
+
+def make_binary(size):
+    """Records of a small integer and a float, like a binary data file."""
+    rng = random.Random(2)
+    out = bytearray()
+    while len(out) < size:
+        out += struct.pack("<If", rng.randrange(1000), rng.randrange(100) / 7)
+    return bytes(out[:size])
+
+
+def make_random(size):
+    """Incompressible random bytes."""
+    return random.Random(3).getrandbits(8 * size).to_bytes(size, "little") if size else b""
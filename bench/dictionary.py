@@ -0,0 +1,62 @@
+"""Compares the compression speed of the Dictionary engines.
+
+Usage: python bench/dictionary.py [--size MB] [--repeat N] [FILE]
+
+Compresses the input with Dictionary.hash, Dictionary.bucketed and Dictionary.direct at
+each code width (direct only supports up to 12 bits) and reports the MB/s of each and
+the probes per input byte of hash. The outputs are checked to be identical. Without a
+file, random, text and binary corpora are used. Random data fills the table fastest and
+looks up a new string for nearly every byte. At 16 bits, the full hash table is half
+occupied, which is where hash probes the most and bucketed gains.
+"""
+
+import argparse
+
+from common import best_time, make_binary, make_random, make_text
+from ncompress import Dictionary, Stats, compress
+
+MAX_DIRECT_BITS = 12
+ENGINES = [
+    ("hash", Dictionary.hash),
+    ("bucketed", Dictionary.bucketed),
+    ("direct", Dictionary.direct),
+]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("file", nargs="?", help="file to use as the input")
+    parser.add_argument("--size", type=float, default=16.0, help="synthetic input size in MB")
+    parser.add_argument("--repeat", type=int, default=5, help="runs per measurement, best is kept")
+    args = parser.parse_args()
+
+    if args.file:
+        with open(args.file, "rb") as f:
+            corpora = [(args.file, f.read())]
+    else:
+        size = int(args.size * 1e6)
+        corpora = [("random", make_random(size)), ("text", make_text(size)),
+                   ("binary", make_binary(size))]
+
+    print(f"{'input':<10}{'bits':>5}{'ratio':>8}{'probes/B':>10}"
+          + "".join(f"{engine_name + ' MB/s':>15}" for engine_name, _ in ENGINES))
+    for name, data in corpora:
+        mb = len(data) / 1e6
+        for max_bits in range(9, 17):
+            stats = Stats()
+            compressed = compress(data, max_bits=max_bits, stats=stats)
+            line = (f"{name:<10}{max_bits:>5}{len(data) / len(compressed):>8.3f}"
+                    f"{stats.probes / max(len(data), 1):>10.2f}")
+            for _, engine in ENGINES:
+                if engine == Dictionary.direct and max_bits > MAX_DIRECT_BITS:
+                    line += f"{'-':>15}"
+                    continue
+                assert compress(data, max_bits=max_bits, dictionary=engine) == compressed
+                t = best_time(lambda: compress(data, max_bits=max_bits, dictionary=engine),
+                              args.repeat)
+                line += f"{mb / t:>15.1f}"
+            print(line)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,61 @@
+"""Measures decompress() on streams containing many CLEAR codes.
+
+Usage: python bench/frequent_clear.py [--size MB] [--repeat N] [FILE]
+
+The input is compressed in segments of decreasing size, each of which starts with a CLEAR
+code, so the decoder resets its table and skips to the next group boundary increasingly often.
+Without a file, a highly compressible synthetic log is used.
+"""
+
+import argparse
+import io
+import random
+
+from common import best_time
+from ncompress import build_index, compress, decompress
+
+
+def make_corpus(size):
+    rng = random.Random(0)
+    levels = [b"DEBUG", b"INFO", b"WARN", b"ERROR"]
+    out = bytearray()
+    t = 0
+    while len(out) < size:
+        t += rng.randrange(1000)
+        out += b"2024-01-30 12:%02d:%02d.%03d %s worker-%d: request %d done in %d ms\n" % (
+            t // 60000 % 60, t // 1000 % 60, t % 1000, rng.choice(levels), rng.randrange(8),
+            rng.randrange(100000), rng.randrange(500))
+    return bytes(out[:size])
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("file", nargs="?", help="file to use as the input")
+    parser.add_argument("--size", type=float, default=32.0, help="synthetic input size in MB")
+    parser.add_argument("--repeat", type=int, default=5, help="runs per measurement, best is kept")
+    args = parser.parse_args()
+
+    if args.file:
+        with open(args.file, "rb") as f:
+            data = f.read()
+    else:
+        data = make_corpus(int(args.size * 1e6))
+
+    mb = len(data) / 1e6
+    print(f"{'segment':>10}{'CLEARs':>10}{'ratio':>8}{'bytes MB/s':>12}{'stream MB/s':>13}")
+    for segment_kb in [None, 1024, 64, 16, 4, 1]:
+        if segment_kb is None:
+            compressed = compress(data)
+        else:
+            compressed = compress(data, threads=2, segment_size=segment_kb << 10)
+        clears = len(build_index(compressed).entries) - 1
+        t_bytes = best_time(lambda: decompress(compressed), args.repeat)
+        t_stream = best_time(lambda: decompress(io.BytesIO(compressed), io.BytesIO()), args.repeat)
+        assert decompress(compressed) == data
+        label = "serial" if segment_kb is None else f"{segment_kb}kB"
+        print(f"{label:>10}{clears:>10}{len(data) / len(compressed):>8.2f}"
+              f"{mb / t_bytes:>12.1f}{mb / t_stream:>13.1f}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,422 @@
+/* Measures the speed and ratio of compress() and decompress() on generated corpora.
+ *
+ * Build with `cmake --build <dir> --target ncompress_bench` and run with --help for the
+ * options. bench/suite.py measures the same through the Python bindings. */
+
+#include "ncompress.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+struct Corpus
+{
+  std::string name;
+  std::string data;
+  size_t record_size; /* Compressed separately in records of this size, 0 for whole */
+};
+
+struct Result
+{
+  std::string corpus;
+  std::string api; /* "memory" or "stream" */
+  int max_bits;
+  size_t buffer_size; /* read_size and write_size, 0 if not used */
+  size_t size;
+  size_t compressed_size;
+  double compress_mbps;
+  double decompress_mbps;
+};
+
+struct Args
+{
+  double size_mb = 8;
+  int repeat = 3;
+  std::vector<int> bits = {9, 12, 16};
+  std::vector<size_t> buffer_sizes = {1 << 10, 64 << 10, 1 << 20};
+  std::string json; /* Path of the JSON output, "-" for stdout */
+  std::vector<std::string> files;
+};
+
+/* Words of 2 to 10 letters, the frequent ones at low indices */
+std::string
+make_text(size_t size)
+{
+  std::mt19937 rng(1);
+  std::vector<std::string> words(3000);
+  for (std::string &word : words)
+  {
+    word.resize(2 + rng() % 9);
+    for (char &c : word)
+      c = (char)('a' + rng() % 26);
+  }
+  std::string out;
+  while (out.size() < size)
+  {
+    out += words[std::min(rng() % 3000, rng() % 3000)];
+    out += rng() % 12 == 0 ? '\n' : ' ';
+  }
+  out.resize(size);
+  return out;
+}
+
+/* Records of a small integer and a float, like a table of measurements */
+std::string
+make_binary(size_t size)
+{
+  std::mt19937 rng(2);
+  std::string out;
+  while (out.size() < size)
+  {
+    std::uint32_t n = rng() % 1000;
+    float f = (float)(rng() % 100) / 7;
+    char record[8];
+    memcpy(record, &n, 4);
+    memcpy(record + 4, &f, 4);
+    out.append(record, 8);
+  }
+  out.resize(size);
+  return out;
+}
+
+std::string
+make_random(size_t size)
+{
+  std::mt19937 rng(3);
+  std::string out(size, '\0');
+  for (char &c : out)
+    c = (char)rng();
+  return out;
+}
+
+/* A 4 kB block of text repeated with a changed byte every 64 kB */
+std::string
+make_repetitive(size_t size)
+{
+  std::string block = make_text(4096);
+  std::string out;
+  while (out.size() < size)
+  {
+    out += block;
+    if (out.size() % 65536 == 0)
+      out.back() = '#';
+  }
+  out.resize(size);
+  return out;
+}
+
+/* Discards the output */
+class null_sink : public ncompress::Sink
+{
+  public:
+  void write(const char *, size_t) override {}
+};
+
+double
+seconds()
+{
+  return std::chrono::duration<double>(
+      std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+template <class F>
+double
+best_time(int repeat, F f)
+{
+  double best = 1e300;
+  for (int i = 0; i < repeat; ++i)
+  {
+    double start = seconds();
+    f();
+    best = std::min(best, seconds() - start);
+  }
+  return best;
+}
+
+double
+mbps(size_t size, double time)
+{
+  return time > 0 ? (double)size / 1e6 / time : 0;
+}
+
+/* Compresses and decompresses the corpus in memory, record by record if it has them */
+Result
+bench_memory(const Corpus &corpus, int max_bits, int repeat)
+{
+  ncompress::Context ctx;
+  ncompress::CompressOptions options;
+  options.max_bits = max_bits;
+
+  const std::string &data = corpus.data;
+  size_t record_size = corpus.record_size ? corpus.record_size : data.size();
+  std::vector<size_t> offsets; /* Record i is at offsets[i]..offsets[i + 1] */
+  std::string packed;
+  for (size_t pos = 0; pos == 0 || pos < data.size(); pos += record_size)
+  {
+    size_t n = std::min(record_size, data.size() - pos);
+    std::string buf(ncompress::compress_bound(n, options), '\0');
+    offsets.push_back(packed.size());
+    size_t packed_size =
+        ncompress::compress(ctx, &data[pos], n, &buf[0], buf.size(), options);
+    packed.append(buf, 0, packed_size);
+  }
+  offsets.push_back(packed.size());
+
+  std::string out(ncompress::compress_bound(record_size, options), '\0');
+  double t_comp = best_time(repeat, [&] {
+    for (size_t pos = 0; pos == 0 || pos < data.size(); pos += record_size)
+    {
+      ncompress::compress(ctx, &data[pos], std::min(record_size, data.size() - pos),
+          &out[0], out.size(), options);
+    }
+  });
+
+  std::string unpacked(data.size(), '\0');
+  double t_decomp = best_time(repeat, [&] {
+    size_t pos = 0;
+    for (size_t i = 0; i + 1 < offsets.size(); ++i)
+    {
+      pos += ncompress::decompress(ctx, &packed[offsets[i]], offsets[i + 1] - offsets[i],
+          &unpacked[pos], unpacked.size() - pos);
+    }
+  });
+  if (unpacked != data)
+    throw std::runtime_error(corpus.name + ": decompressed data does not match");
+
+  return Result{corpus.name, "memory", max_bits, 0, data.size(), packed.size(),
+      mbps(data.size(), t_comp), mbps(data.size(), t_decomp)};
+}
+
+/* Compresses and decompresses the corpus through std::istream in chunks of buffer_size */
+Result
+bench_stream(const Corpus &corpus, size_t buffer_size, int repeat)
+{
+  ncompress::Context ctx;
+  ncompress::CompressOptions options;
+  options.read_size = options.write_size = buffer_size;
+  ncompress::DecompressOptions doptions;
+  doptions.read_size = doptions.write_size = buffer_size;
+  null_sink discard;
+
+  std::ostringstream packed_stream;
+  {
+    std::istringstream in(corpus.data);
+    ncompress::compress(in, packed_stream, options);
+  }
+  std::string packed = packed_stream.str();
+
+  double t_comp = best_time(repeat, [&] {
+    std::istringstream in(corpus.data);
+    ncompress::compress(ctx, in, discard, options);
+  });
+  double t_decomp = best_time(repeat, [&] {
+    std::istringstream in(packed);
+    ncompress::decompress(ctx, in, discard, doptions);
+  });
+
+  return Result{corpus.name, "stream", options.max_bits, buffer_size, corpus.data.size(),
+      packed.size(), mbps(corpus.data.size(), t_comp),
+      mbps(corpus.data.size(), t_decomp)};
+}
+
+std::string
+json_string(const std::string &s)
+{
+  std::string out = "\"";
+  for (char c : s)
+  {
+    if (c == '"' || c == '\\')
+      out += '\\';
+    if ((unsigned char)c < 0x20)
+    {
+      char esc[8];
+      snprintf(esc, sizeof(esc), "\\u%04x", (unsigned)c);
+      out += esc;
+    }
+    else
+      out += c;
+  }
+  return out + "\"";
+}
+
+void
+write_json(std::ostream &out, const Args &args, const std::vector<Result> &results)
+{
+  out << "{\n  \"benchmark\": \"ncompress_bench\",\n  \"repeat\": " << args.repeat
+      << ",\n  \"results\": [";
+  for (size_t i = 0; i < results.size(); ++i)
+  {
+    const Result &r = results[i];
+    char numbers[256];
+    snprintf(numbers, sizeof(numbers),
+        "\"max_bits\": %d, \"buffer_size\": %zu, \"size\": %zu, \"compressed_size\": "
+        "%zu, \"ratio\": %.4f, \"compress_mbps\": %.2f, \"decompress_mbps\": %.2f",
+        r.max_bits, r.buffer_size, r.size, r.compressed_size,
+        r.compressed_size ? (double)r.size / r.compressed_size : 0, r.compress_mbps,
+        r.decompress_mbps);
+    out << (i ? ",\n" : "\n") << "    {\"corpus\": " << json_string(r.corpus)
+        << ", \"api\": " << json_string(r.api) << ", " << numbers << "}";
+  }
+  out << "\n  ]\n}\n";
+}
+
+template <class T>
+std::vector<T>
+parse_list(const char *s)
+{
+  std::vector<T> values;
+  std::istringstream in(s);
+  std::string item;
+  while (std::getline(in, item, ','))
+    values.push_back((T)std::stod(item));
+  if (values.empty())
+    throw std::invalid_argument(std::string("empty list: ") + s);
+  return values;
+}
+
+const char usage[] =
+    "Usage: ncompress_bench [options] [FILE ...]\n"
+    "\n"
+    "Measures compress() and decompress() in MB/s of uncompressed data, in memory\n"
+    "for each code width and through std::istream for each buffer size. Without\n"
+    "files, text, binary, random and repetitive corpora and text in 100-byte records\n"
+    "are generated.\n"
+    "\n"
+    "  --size MB          size of the generated corpora (default 8)\n"
+    "  --repeat N         runs per measurement, the best is kept (default 3)\n"
+    "  --bits N,...       code widths (default 9,12,16)\n"
+    "  --buffer-sizes N,...  stream buffer sizes in kB (default 1,64,1024)\n"
+    "  --json PATH        write the results as JSON to PATH, - for stdout\n";
+
+Args
+parse_args(int argc, char **argv)
+{
+  Args args;
+  for (int i = 1; i < argc; ++i)
+  {
+    std::string arg = argv[i];
+    if (arg == "-h" || arg == "--help")
+    {
+      fputs(usage, stdout);
+      exit(0);
+    }
+    if (arg.compare(0, 2, "--") != 0)
+    {
+      args.files.push_back(arg);
+      continue;
+    }
+    if (i + 1 == argc)
+      throw std::invalid_argument(arg + " needs a value");
+    const char *value = argv[++i];
+    if (arg == "--size")
+      args.size_mb = std::stod(value);
+    else if (arg == "--repeat")
+      args.repeat = std::max(1, std::stoi(value));
+    else if (arg == "--bits")
+      args.bits = parse_list<int>(value);
+    else if (arg == "--buffer-sizes")
+    {
+      args.buffer_sizes.clear();
+      for (double kb : parse_list<double>(value))
+        args.buffer_sizes.push_back((size_t)(kb * 1024));
+    }
+    else if (arg == "--json")
+      args.json = value;
+    else
+      throw std::invalid_argument("unknown option " + arg);
+  }
+  return args;
+}
+
+std::vector<Corpus>
+load_corpora(const Args &args)
+{
+  std::vector<Corpus> corpora;
+  for (const std::string &path : args.files)
+  {
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+      throw std::runtime_error("cannot open " + path);
+    std::ostringstream data;
+    data << in.rdbuf();
+    corpora.push_back(Corpus{path.substr(path.find_last_of("/\\") + 1), data.str(), 0});
+  }
+  if (corpora.empty())
+  {
+    size_t size = (size_t)(args.size_mb * 1e6);
+    corpora.push_back(Corpus{"text", make_text(size), 0});
+    corpora.push_back(Corpus{"binary", make_binary(size), 0});
+    corpora.push_back(Corpus{"random", make_random(size), 0});
+    corpora.push_back(Corpus{"repetitive", make_repetitive(size), 0});
+    corpora.push_back(Corpus{"tiny", make_text(size / 10), 100});
+  }
+  return corpora;
+}
+
+} // namespace
+
+int
+main(int argc, char **argv)
+{
+  try
+  {
+    Args args = parse_args(argc, argv);
+    std::vector<Corpus> corpora = load_corpora(args);
+    FILE *table = args.json == "-" ? stderr : stdout;
+
+    std::vector<Result> results;
+    fprintf(table, "%-12s%-8s%6s%10s%8s%15s%17s\n", "corpus", "api", "bits", "buffer",
+        "ratio", "compress MB/s", "decompress MB/s");
+    for (const Corpus &corpus : corpora)
+    {
+      std::vector<Result> rows;
+      for (int bits : args.bits)
+        rows.push_back(bench_memory(corpus, bits, args.repeat));
+      if (corpus.record_size == 0)
+      {
+        for (size_t buffer_size : args.buffer_sizes)
+          rows.push_back(bench_stream(corpus, buffer_size, args.repeat));
+      }
+      for (const Result &r : rows)
+      {
+        std::string buffer =
+            r.buffer_size ? std::to_string(r.buffer_size >> 10) + "kB" : "";
+        fprintf(table, "%-12s%-8s%6d%10s%8.2f%15.1f%17.1f\n", r.corpus.c_str(),
+            r.api.c_str(), r.max_bits, buffer.c_str(), (double)r.size / r.compressed_size,
+            r.compress_mbps, r.decompress_mbps);
+        fflush(table);
+      }
+      results.insert(results.end(), rows.begin(), rows.end());
+    }
+
+    if (args.json == "-")
+      write_json(std::cout, args, results);
+    else if (!args.json.empty())
+    {
+      std::ofstream out(args.json);
+      write_json(out, args, results);
+      if (!out)
+        throw std::runtime_error("cannot write " + args.json);
+    }
+  }
+  catch (const std::exception &e)
+  {
+    fprintf(stderr, "ncompress_bench: %s\n", e.what());
+    return 1;
+  }
+  return 0;
+}
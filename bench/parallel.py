@@ -0,0 +1,62 @@
+"""Measures the scaling of compress() and decompress() with threads=N and the ratio cost of
+the segment size.
+
+Usage: python bench/parallel.py [--size MB] [--max-threads N] [FILE]
+
+Without a file, a synthetic text corpus is used.
+"""
+
+import argparse
+import os
+
+from common import best_time, make_text
+from ncompress import compress, decompress
+
+
+def scaling(func, size, threads):
+    base = size / best_time(lambda: func(1), 3) / 1e6
+    print(f"{'threads':>8}{'MB/s':>10}{'speedup':>10}")
+    print(f"{'serial':>8}{base:>10.1f}{1:>10.2f}")
+    for n in threads[1:]:
+        rate = size / best_time(lambda: func(n), 3) / 1e6
+        print(f"{n:>8}{rate:>10.1f}{rate / base:>10.2f}")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("file", nargs="?", help="file to use as the corpus")
+    parser.add_argument("--size", type=float, default=64.0, help="synthetic corpus size in MB")
+    parser.add_argument("--max-threads", type=int, default=os.cpu_count())
+    args = parser.parse_args()
+
+    if args.file:
+        with open(args.file, "rb") as f:
+            data = f.read()
+    else:
+        data = make_text(int(args.size * 1e6), seed=0, vocabulary=20000)
+
+    serial = compress(data)
+    threads = [1]
+    while threads[-1] * 2 <= args.max_threads:
+        threads.append(threads[-1] * 2)
+    if threads[-1] != args.max_threads:
+        threads.append(args.max_threads)
+    segmented = compress(data, threads=2)
+    print("compress")
+    scaling(lambda n: compress(data, threads=n), len(data), threads)
+    print()
+    print("decompress")
+    scaling(lambda n: decompress(segmented, threads=n), len(data), threads)
+
+    print()
+    print(f"{'segment':>10}{'ratio':>8}{'size vs serial':>16}")
+    print(f"{'serial':>10}{len(data) / len(serial):>8.3f}{0:>+15.2f}%")
+    for segment_kb in [64, 256, 1024, 4096, 16384]:
+        out = compress(data, threads=max(args.max_threads, 2), segment_size=segment_kb << 10)
+        assert decompress(out) == data
+        ratio = len(data) / len(out)
+        print(f"{segment_kb:>8}kB{ratio:>8.3f}{100 * (len(out) / len(serial) - 1):>+15.2f}%")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,52 @@
+"""Measures decompress_range() on random offsets against decompressing the whole stream.
+
+Usage: python bench/random_access.py [--size MB] [--length BYTES] [FILE]
+
+Without a file, a synthetic text corpus is used.
+"""
+
+import argparse
+import random
+import time
+
+from common import make_text
+from ncompress import Index, compress, decompress, decompress_range
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("file", nargs="?", help="file to use as the corpus")
+    parser.add_argument("--size", type=float, default=64.0, help="synthetic corpus size in MB")
+    parser.add_argument("--length", type=int, default=4096, help="bytes per range read")
+    args = parser.parse_args()
+
+    if args.file:
+        with open(args.file, "rb") as f:
+            data = f.read()
+    else:
+        data = make_text(int(args.size * 1e6), seed=0, vocabulary=20000)
+
+    serial = compress(data)
+    start = time.perf_counter()
+    decompress(serial)
+    full = time.perf_counter() - start
+    print(f"full decompress: {full * 1e3:.1f} ms")
+    print()
+    print(f"{'segment':>10}{'entries':>10}{'index kB':>10}{'size vs serial':>16}{'range ms':>10}")
+    rng = random.Random(1)
+    for segment_kb in [64, 256, 1024, 4096]:
+        index = Index()
+        compressed = compress(data, threads=2, segment_size=segment_kb << 10, index=index)
+        offsets = [rng.randrange(len(data)) for _ in range(50)]
+        start = time.perf_counter()
+        for offset in offsets:
+            assert decompress_range(compressed, index, offset, args.length) == \
+                data[offset:offset + args.length]
+        per_read = (time.perf_counter() - start) / len(offsets)
+        growth = 100 * (len(compressed) / len(serial) - 1)
+        print(f"{segment_kb:>8}kB{len(index.entries):>10}{len(index.to_bytes()) / 1024:>10.1f}"
+              f"{growth:>+15.2f}%{per_read * 1e3:>10.2f}")
+
+
+if __name__ == "__main__":
+    main()
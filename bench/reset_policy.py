@@ -0,0 +1,80 @@
+"""Compares the compression ratio and speed of table reset policies.
+
+Usage: python bench/reset_policy.py [--size MB] [--repeat N] [--max-bits N] [FILE]
+
+Each ResetPolicy is run over the same input and reported with its ratio, compress() and
+decompress() speed, the number of CLEAR codes and the hash table probes per input byte.
+Without a file, a synthetic log is used whose vocabulary changes every few MB, with
+base64-encoded blobs mixed in, which is where the default policy tends to keep a stale
+table for a long time.
+"""
+
+import argparse
+import base64
+import random
+
+from common import best_time, make_words
+from ncompress import ResetPolicy, Stats, compress, decompress_into
+
+POLICIES = [
+    ("default", ResetPolicy()),
+    ("never", ResetPolicy(check_interval=0)),
+    ("check 1 kB", ResetPolicy(check_interval=1000)),
+    ("check 100 kB", ResetPolicy(check_interval=100000)),
+    ("threshold 2%", ResetPolicy(threshold=0.02)),
+    ("threshold 10%", ResetPolicy(threshold=0.1)),
+    ("every 256 kB", ResetPolicy(check_interval=0, reset_interval=256 << 10)),
+    ("every 1 MB", ResetPolicy(check_interval=0, reset_interval=1 << 20)),
+    ("every 1 MB+ratio", ResetPolicy(reset_interval=1 << 20)),
+]
+
+
+def make_corpus(size):
+    rng = random.Random(0)
+    out = bytearray()
+    t = 0
+    while len(out) < size:
+        # A new set of services and messages every 2-6 MB
+        phase_end = len(out) + rng.randrange(2_000_000, 6_000_000)
+        services = [f"svc-{rng.randrange(10 ** 6)}".encode() for _ in range(8)]
+        words = make_words(rng, 200, 3, 9)
+        while len(out) < min(phase_end, size):
+            t += rng.randrange(1000)
+            message = b" ".join(rng.choice(words) for _ in range(rng.randint(3, 10)))
+            out += b"%d.%03d %s %s\n" % (t // 1000, t % 1000, rng.choice(services), message)
+            if rng.randrange(2000) == 0:
+                n = rng.randrange(100, 20000)
+                out += base64.b64encode(rng.getrandbits(8 * n).to_bytes(n, "little")) + b"\n"
+    return bytes(out[:size])
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("file", nargs="?", help="file to use as the input")
+    parser.add_argument("--size", type=float, default=32.0, help="synthetic input size in MB")
+    parser.add_argument("--repeat", type=int, default=5, help="runs per measurement, best is kept")
+    parser.add_argument("--max-bits", type=int, default=16, help="maximum code width")
+    args = parser.parse_args()
+
+    if args.file:
+        with open(args.file, "rb") as f:
+            data = f.read()
+    else:
+        data = make_corpus(int(args.size * 1e6))
+
+    mb = len(data) / 1e6
+    out = bytearray(len(data))
+    print(f"{'policy':<18}{'ratio':>8}{'comp MB/s':>11}{'decomp MB/s':>13}{'CLEARs':>9}{'probes/B':>10}")
+    for name, policy in POLICIES:
+        stats = Stats()
+        compressed = compress(data, max_bits=args.max_bits, reset_policy=policy, stats=stats)
+        t_comp = best_time(lambda: compress(data, max_bits=args.max_bits, reset_policy=policy),
+                           args.repeat)
+        t_decomp = best_time(lambda: decompress_into(compressed, out), args.repeat)
+        assert out == data
+        print(f"{name:<18}{len(data) / len(compressed):>8.3f}{mb / t_comp:>11.1f}"
+              f"{mb / t_decomp:>13.1f}{stats.clears:>9}{stats.probes / max(len(data), 1):>10.2f}")
+
+
+if __name__ == "__main__":
+    main()
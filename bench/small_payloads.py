@@ -0,0 +1,51 @@
+"""Measures the per-call time of compress() and decompress() on small payloads.
+
+Stream input is measured with and without a size_hint.
+
+Usage: python bench/small_payloads.py [--sizes N,N,...] [--seconds S]
+"""
+
+import argparse
+import time
+from io import BytesIO
+
+from common import make_plain_text
+from ncompress import compress, decompress, decompress_into
+
+
+def per_call(func, seconds):
+    calls = 0
+    start = time.perf_counter()
+    while True:
+        for _ in range(100):
+            func()
+        calls += 100
+        elapsed = time.perf_counter() - start
+        if elapsed >= seconds:
+            return elapsed / calls
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--sizes", default="100,300,1000,3000,10000",
+                        help="comma-separated payload sizes in bytes")
+    parser.add_argument("--seconds", type=float, default=0.5, help="time per measurement")
+    args = parser.parse_args()
+
+    print(f"{'size':>8}{'compress us':>14}{'stream us':>12}{'stream+hint us':>16}"
+          f"{'decompress us':>16}{'decompress_into us':>20}")
+    for size in map(int, args.sizes.split(",")):
+        data = make_plain_text(size, seed=size)
+        compressed = compress(data)
+        out = bytearray(size)
+        c = per_call(lambda: compress(data), args.seconds)
+        s = per_call(lambda: compress(BytesIO(data)), args.seconds)
+        s_hint = per_call(lambda: compress(BytesIO(data), size_hint=size), args.seconds)
+        d = per_call(lambda: decompress(compressed), args.seconds)
+        d_into = per_call(lambda: decompress_into(compressed, out), args.seconds)
+        print(f"{size:>8}{c * 1e6:>14.2f}{s * 1e6:>12.2f}{s_hint * 1e6:>16.2f}"
+              f"{d * 1e6:>16.2f}{d_into * 1e6:>20.2f}")
+
+
+if __name__ == "__main__":
+    main()
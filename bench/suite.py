@@ -0,0 +1,116 @@
+"""Benchmark suite of compress() and decompress() for pytest-benchmark.
+
+Usage: pytest bench/suite.py [--benchmark-json FILE] [--benchmark-compare] [-k FILTER]
+
+Covers the same corpora, code widths and buffer sizes as the ncompress_bench C++ target:
+text, binary, random and repetitive data of NCOMPRESS_BENCH_MB megabytes (8 by default)
+and text in 100-byte records. Every benchmark stores the input size, compressed size,
+ratio and MB/s in its extra_info, so they end up in the JSON output for regression
+tracking. Requires `pip install pytest-benchmark`.
+"""
+
+import os
+from io import BytesIO
+
+import pytest
+from common import make_binary, make_random, make_text
+from ncompress import compress, compress_many, decompress, decompress_many
+
+SIZE = int(float(os.environ.get("NCOMPRESS_BENCH_MB", "8")) * 1e6)
+RECORD_SIZE = 100
+
+
+def make_repetitive(size):
+    block = make_text(4096)
+    out = bytearray()
+    while len(out) < size:
+        out += block
+        if len(out) % 65536 == 0:
+            out[-1:] = b"#"
+    return bytes(out[:size])
+
+
+CORPORA = {
+    "text": make_text,
+    "binary": make_binary,
+    "random": make_random,
+    "repetitive": make_repetitive,
+}
+
+
+@pytest.fixture(scope="module", params=list(CORPORA))
+def corpus(request):
+    return request.param, CORPORA[request.param](SIZE)
+
+
+def record(benchmark, size, compressed_size):
+    benchmark.extra_info["size"] = size
+    benchmark.extra_info["compressed_size"] = compressed_size
+    benchmark.extra_info["ratio"] = size / compressed_size if compressed_size else 0
+    metadata = getattr(benchmark, "stats", None)  # None with --benchmark-disable
+    stats = metadata.stats if metadata else None
+    if stats and stats.min > 0:
+        benchmark.extra_info["mbps"] = size / 1e6 / stats.min
+
+
+@pytest.mark.parametrize("max_bits", [9, 12, 16])
+def test_compress(benchmark, corpus, max_bits):
+    benchmark.group = f"compress {corpus[0]}"
+    data = corpus[1]
+    compressed = benchmark(compress, data, max_bits=max_bits)
+    record(benchmark, len(data), len(compressed))
+
+
+@pytest.mark.parametrize("max_bits", [9, 12, 16])
+def test_decompress(benchmark, corpus, max_bits):
+    benchmark.group = f"decompress {corpus[0]}"
+    data = corpus[1]
+    compressed = compress(data, max_bits=max_bits)
+    assert benchmark(decompress, compressed) == data
+    record(benchmark, len(data), len(compressed))
+
+
+@pytest.mark.parametrize("buffer_size", [1 << 10, 64 << 10, 1 << 20])
+def test_compress_stream(benchmark, corpus, buffer_size):
+    benchmark.group = f"compress stream {corpus[0]}"
+    data = corpus[1]
+    compressed = benchmark(lambda: compress(BytesIO(data), buffer_size=buffer_size))
+    record(benchmark, len(data), len(compressed))
+
+
+@pytest.mark.parametrize("buffer_size", [1 << 10, 64 << 10, 1 << 20])
+def test_decompress_stream(benchmark, corpus, buffer_size):
+    benchmark.group = f"decompress stream {corpus[0]}"
+    data = corpus[1]
+    compressed = compress(data)
+    assert benchmark(lambda: decompress(BytesIO(compressed), buffer_size=buffer_size)) == data
+    record(benchmark, len(data), len(compressed))
+
+
+@pytest.fixture(scope="module")
+def tiny_records():
+    data = make_text(SIZE // 10)
+    return [data[i:i + RECORD_SIZE] for i in range(0, len(data), RECORD_SIZE)]
+
+
+@pytest.mark.parametrize("batched", [False, True], ids=["calls", "many"])
+def test_compress_tiny(benchmark, tiny_records, batched):
+    benchmark.group = "compress tiny"
+    if batched:
+        compressed, _ = benchmark(compress_many, tiny_records)
+    else:
+        compressed = b"".join(benchmark(lambda: [compress(r) for r in tiny_records]))
+    record(benchmark, sum(map(len, tiny_records)), len(compressed))
+
+
+@pytest.mark.parametrize("batched", [False, True], ids=["calls", "many"])
+def test_decompress_tiny(benchmark, tiny_records, batched):
+    benchmark.group = "decompress tiny"
+    data, offsets = compress_many(tiny_records)
+    compressed = [data[offsets[i]:offsets[i + 1]] for i in range(len(tiny_records))]
+    if batched:
+        out, _ = benchmark(decompress_many, compressed)
+    else:
+        out = b"".join(benchmark(lambda: [decompress(c) for c in compressed]))
+    assert out == b"".join(tiny_records)
+    record(benchmark, len(out), len(data))
@@ -0,0 +1,57 @@
+"""Measures how compress() and decompress() scale across Python threads.
+
+Usage: python bench/threads.py [--size MB] [--calls N] [--max-threads N]
+"""
+
+import argparse
+import os
+import time
+from concurrent.futures import ThreadPoolExecutor
+from io import BytesIO
+
+from common import make_plain_text
+from ncompress import compress, decompress
+
+
+def run(func, arg, calls, threads):
+    with ThreadPoolExecutor(max_workers=threads) as pool:
+        start = time.perf_counter()
+        for _ in pool.map(lambda _: func(arg()), range(calls)):
+            pass
+        return time.perf_counter() - start
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--size", type=float, default=1.0, help="payload size in MB")
+    parser.add_argument("--calls", type=int, default=64, help="calls per measurement")
+    parser.add_argument("--max-threads", type=int, default=os.cpu_count())
+    args = parser.parse_args()
+
+    data = make_plain_text(int(args.size * 1e6))
+    compressed = compress(data)
+    cases = [
+        ("compress bytes", compress, lambda: data, len(data)),
+        ("decompress bytes", decompress, lambda: compressed, len(data)),
+        ("compress stream", compress, lambda: BytesIO(data), len(data)),
+        ("decompress stream", decompress, lambda: BytesIO(compressed), len(data)),
+    ]
+
+    threads = [1]
+    while threads[-1] * 2 <= args.max_threads:
+        threads.append(threads[-1] * 2)
+    if threads[-1] != args.max_threads:
+        threads.append(args.max_threads)
+
+    print(f"{'case':<20}{'threads':>8}{'MB/s':>10}{'speedup':>10}")
+    for name, func, arg, size in cases:
+        base = None
+        for n in threads:
+            elapsed = run(func, arg, args.calls, n)
+            rate = size * args.calls / elapsed / 1e6
+            base = base or rate
+            print(f"{name:<20}{n:>8}{rate:>10.1f}{rate / base:>10.2f}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,46 @@
+"""Measures the compress(), decompress() and decompress_into() throughput on corpora.
+
+Usage: python bench/throughput.py [--size MB] [--repeat N] [FILE ...]
+
+Without files, synthetic text, binary, random and all-zeros corpora are used.
+"""
+
+import argparse
+import os
+
+from common import best_time, make_binary, make_random, make_text
+from ncompress import compress, decompress, decompress_into
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("files", nargs="*", help="files to use as corpora")
+    parser.add_argument("--size", type=float, default=8.0, help="synthetic corpus size in MB")
+    parser.add_argument("--repeat", type=int, default=5, help="runs per measurement, best is kept")
+    args = parser.parse_args()
+
+    if args.files:
+        corpora = [(os.path.basename(path), open(path, "rb").read()) for path in args.files]
+    else:
+        size = int(args.size * 1e6)
+        corpora = [
+            ("text", make_text(size)),
+            ("binary", make_binary(size)),
+            ("random", make_random(size)),
+            ("zeros", bytes(size)),
+        ]
+
+    print(f"{'corpus':<16}{'ratio':>8}{'compress MB/s':>16}{'decompress MB/s':>18}{'into MB/s':>12}")
+    for name, data in corpora:
+        compressed = compress(data)
+        out = bytearray(len(data))
+        c = best_time(lambda: compress(data), args.repeat)
+        d = best_time(lambda: decompress(compressed), args.repeat)
+        d_into = best_time(lambda: decompress_into(compressed, out), args.repeat)
+        ratio = len(data) / max(len(compressed), 1)
+        print(f"{name:<16}{ratio:>8.2f}{len(data) / c / 1e6:>16.1f}{len(data) / d / 1e6:>18.1f}"
+              f"{len(data) / d_into / 1e6:>12.1f}")
+
+
+if __name__ == "__main__":
+    main()
@@ -16,18 +16,351 @@
 
 #pragma once
 
+#include <cstddef>
 #include <istream>
+#include <memory>
 #include <ostream>
+#include <string>
+#include <vector>
 
 namespace ncompress
 {
 
+/**
+ * Receives the output of compress() and decompress() in chunks.
+ */
+class Sink
+{
+  public:
+  virtual ~Sink() = default;
+
+  /**
+   * Consumes the next chunk of output data.
+   */
+  virtual void write(const char *data, size_t size) = 0;
+};
+
+static const int MIN_BITS = 9; /* Smallest supported maximum code width */
+static const int MAX_BITS = 16; /* Largest supported maximum code width */
+static const size_t MAX_BUFFER_SIZE = 64 << 20; /* Largest read_size and write_size */
+static const int MAX_DIRECT_BITS = 12; /* Largest max_bits of Dictionary::direct */
+
+/**
+ * Locations of the independently decodable segments of a compressed stream.
+ *
+ * A CLEAR code makes the decoder start over with an empty table, so the data between two
+ * CLEAR codes can be decoded without anything that precedes it. compress() emits them
+ * between the segments when using multiple threads and whenever the compression ratio
+ * starts to drop after the table has filled up.
+ */
+struct Index
+{
+  /**
+   * Start of a segment.
+   */
+  struct Entry
+  {
+    size_t in_offset; /**< Offset of the first code in the compressed data */
+    size_t out_offset; /**< Offset of the first byte in the decompressed data */
+  };
+
+  /**
+   * The segments in order, starting with the one right after the header.
+   */
+  std::vector<Entry> entries;
+
+  size_t compressed_size = 0;
+  size_t decompressed_size = 0;
+};
+
+/**
+ * Statistics of a call, filled in when passed as CompressOptions::stats or
+ * DecompressOptions::stats.
+ *
+ * The coding loops are compiled twice, with and without the per-code counters, and the
+ * clock is only read when statistics are requested, so calls without them run at full
+ * speed. With multiple threads, the counts are summed over the threads.
+ */
+struct Stats
+{
+  size_t bytes_in = 0; /**< Size of the input */
+  size_t bytes_out = 0; /**< Size of the output */
+  size_t codes = 0; /**< Codes written or read, not counting CLEAR codes */
+  size_t clears = 0; /**< CLEAR codes, after each of which the table starts over */
+  size_t width_changes = 0; /**< Increases of the code width */
+
+  /**
+   * Hash table slots looked at while compressing, one per input byte if there were no
+   * collisions.
+   */
+  size_t probes = 0;
+
+  double seconds = 0; /**< Wall-clock time of the call */
+
+  /**
+   * Part of seconds spent reading the input from a std::istream and passing the output
+   * on to the sink or std::ostream, the rest being spent coding.
+   */
+  double io_seconds = 0;
+};
+
+/**
+ * When the compressor clears its table and starts over with a CLEAR code.
+ *
+ * By default, the table is kept until it is full and then cleared as soon as the
+ * compression ratio, checked every 10000 input bytes, drops, like compress(1) does. The
+ * output is a standard stream with any policy.
+ */
+struct ResetPolicy
+{
+  /**
+   * Input bytes between checks of the compression ratio once the table is full, 0 to
+   * never reset because of the ratio.
+   */
+  size_t check_interval = 10000;
+
+  /**
+   * Fraction between 0 and 1 by which the ratio must drop below its best since the last
+   * reset for the table to be cleared. 0 resets on any drop, larger values keep the table
+   * through short stretches of poorly compressible input.
+   */
+  double threshold = 0;
+
+  /**
+   * Input bytes after which the table is cleared even if it is not full or the ratio has
+   * not dropped, 0 for never. Suits input whose content changes over time, e.g. logs.
+   */
+  size_t reset_interval = 0;
+};
+
+/**
+ * Data structure the compressor looks up strings in. The output is the same with all of
+ * them, only the speed and memory use differ.
+ */
+enum class Dictionary
+{
+  /**
+   * Hash table with double hashing. Sized for the input and grown as needed, so it is
+   * cheap to set up for small inputs.
+   */
+  hash,
+
+  /**
+   * Table of the 256 possible extensions of every code, which finds a string with a
+   * single lookup and no collisions. Takes 512 << max_bits bytes, so it requires max_bits
+   * of at most MAX_DIRECT_BITS (2 MB). Compresses about 1.5-2.5x as fast as hash, most
+   * of all on poorly compressible input, but the table is costly to set up for a single
+   * small input. Reuse a Context for those.
+   */
+  direct,
+
+  /**
+   * Hash table with the slots grouped into buckets of one cache line, which are searched
+   * with SSE2 or AVX2 depending on the CPU. A lookup usually reads a single cache line,
+   * where hash probes many scattered slots once the table fills up. Takes 64 bytes per
+   * bucket, 1 MB for 16 bits, and is sized for the input and grown like hash.
+   */
+  bucketed,
+};
+
+/**
+ * Parameters of compression.
+ */
+struct CompressOptions
+{
+  /**
+   * Maximum code width in bits, between MIN_BITS and MAX_BITS, same as `compress -b`.
+   *
+   * Smaller widths use less memory (the hash table takes 32 << max_bits bytes, up to
+   * 512 kB) and are faster, but usually compress less.
+   */
+  int max_bits = MAX_BITS;
+
+  /**
+   * Data structure strings are looked up in, see Dictionary.
+   */
+  Dictionary dictionary = Dictionary::hash;
+
+  /**
+   * Expected size of the input in bytes, 0 if unknown.
+   *
+   * Small inputs only add a few codes to the hash table, so a smaller table is used for
+   * them, which is faster to set up and fits in the CPU caches. The table is grown if the
+   * input turns out to be larger. The output does not depend on the hint. Overloads
+   * taking the input as a pointer and a size use the size instead.
+   */
+  size_t size_hint = 0;
+
+  /**
+   * Number of threads used by compress(), 0 for one per CPU core.
+   *
+   * With any value other than 1, the input is split into segments of segment_size bytes,
+   * which are compressed independently and joined with CLEAR codes into a single standard
+   * stream, even if 0 resolves to a single thread. The output depends on segment_size,
+   * but not on the number of threads.
+   * Compressor always uses a single thread.
+   */
+  int threads = 1;
+
+  /**
+   * Size of the independently compressed segments when using multiple threads.
+   *
+   * Every segment starts with an empty table, which costs some compression ratio when the
+   * segments are small. When reading from a stream, up to segment_size bytes of input per
+   * thread are buffered, plus the compressed output of up to two segments per thread, so
+   * memory use grows with segment_size times the number of threads. A product that does
+   * not fit in std::streamsize is rejected with std::invalid_argument.
+   */
+  size_t segment_size = 4 << 20;
+
+  /**
+   * When the table is cleared, see ResetPolicy.
+   */
+  ResetPolicy reset_policy;
+
+  /**
+   * If set, receives the index of the output, the same as build_index() would return for
+   * it. The codes are scanned as they are written, which is much cheaper than a second
+   * pass over the output. Set only after the output has been completed.
+   */
+  Index *index = nullptr;
+
+  /**
+   * If set, receives the statistics of the call. Compressor fills it in on finish(),
+   * without the times.
+   */
+  Stats *stats = nullptr;
+
+  /**
+   * Size of the chunks read from a std::istream, in bytes.
+   */
+  size_t read_size = 64 << 10;
+
+  /**
+   * Size of the chunks the output is passed on to the sink or std::ostream in, in bytes.
+   * The encoder's output buffer takes about as much memory.
+   */
+  size_t write_size = 64 << 10;
+};
+
+/**
+ * Parameters of decompression.
+ */
+struct DecompressOptions
+{
+  /**
+   * Number of threads used by decompress() on a block of memory, 0 for one per CPU core.
+   *
+   * Only the segments between CLEAR codes can be decoded in parallel, see Index. Data
+   * compressed with multiple threads always has enough of them.
+   */
+  int threads = 1;
+
+  /**
+   * Index of the input from build_index(), or null to build one when using multiple
+   * threads. Building the index takes a pass over the input, which is several times
+   * faster than decoding it.
+   */
+  const Index *index = nullptr;
+
+  /**
+   * If set, receives the statistics of the call. Decompressor fills it in on finish(),
+   * without the times.
+   */
+  Stats *stats = nullptr;
+
+  /**
+   * Size of the chunks read from a std::istream, in bytes.
+   */
+  size_t read_size = 64 << 10;
+
+  /**
+   * Minimum size of the chunks the output is passed on to the sink or std::ostream in,
+   * except for the last one, in bytes. The decoder buffers this much output on top of the
+   * 256 kB it keeps for back-references and 64 kB for the longest string.
+   */
+  size_t write_size = 64 << 10;
+};
+
+/**
+ * Holds the tables and buffers used by compress() and decompress().
+ *
+ * They are allocated on the heap on first use (up to about 1 MB for compression and 1.2
+ * MB for decompression) and reused by later calls, which only clear the parts that were
+ * used. A context must not be used by multiple threads at the same time.
+ *
+ * The overloads without a context argument use a context cached for the calling thread,
+ * which is kept until the thread exits.
+ */
+class Context
+{
+  public:
+  Context();
+  ~Context();
+
+  Context(const Context &) = delete;
+  Context &operator=(const Context &) = delete;
+
+  struct Impl;
+
+  private:
+  std::unique_ptr<Impl> impl;
+};
+
 /**
  * Applies LZW compression to the input.
  *
  * @throws std::ios_base::failure on stream errors
+ * @throws std::invalid_argument on invalid options
+ */
+void compress(std::istream &in, std::ostream &out,
+    const CompressOptions &options = CompressOptions());
+void compress(
+    std::istream &in, Sink &out, const CompressOptions &options = CompressOptions());
+void compress(Context &ctx, std::istream &in, Sink &out,
+    const CompressOptions &options = CompressOptions());
+
+/**
+ * Applies LZW compression to a block of memory.
+ *
+ * The input is read in place without any intermediate copies.
+ *
+ * @throws std::ios_base::failure on stream errors
+ * @throws std::invalid_argument on invalid options
+ */
+void compress(const void *src, size_t size, std::ostream &out,
+    const CompressOptions &options = CompressOptions());
+void compress(const void *src, size_t size, Sink &out,
+    const CompressOptions &options = CompressOptions());
+void compress(Context &ctx, const void *src, size_t size, Sink &out,
+    const CompressOptions &options = CompressOptions());
+
+/**
+ * Applies LZW compression to a block of memory, writing the output directly into a
+ * caller-supplied buffer. A buffer of compress_bound() bytes is always large enough.
+ *
+ * @return the number of bytes written to dst
+ * @throws std::invalid_argument on invalid options
+ * @throws std::length_error if the compressed data does not fit into dst
+ */
+size_t compress(const void *src, size_t size, void *dst, size_t capacity,
+    const CompressOptions &options = CompressOptions());
+size_t compress(Context &ctx, const void *src, size_t size, void *dst, size_t capacity,
+    const CompressOptions &options = CompressOptions());
+
+/**
+ * Returns the largest possible size of the compressed data for an input of the given
+ * size, whatever its contents.
+ *
+ * Every input byte costs at most one code of options.max_bits bits. On top of that come
+ * the header, and the padding that follows every change of the code width and every
+ * CLEAR code. The bound is about twice the input size for 16 bits. options.threads and
+ * options.segment_size are taken into account, since every segment ends with a CLEAR
+ * code.
+ *
+ * @throws std::invalid_argument on invalid options
  */
-void compress(std::istream &in, std::ostream &out);
+size_t compress_bound(size_t size, const CompressOptions &options = CompressOptions());
 
 /**
  * Decompresses the LZW-compressed input.
@@ -35,7 +368,251 @@ void compress(std::istream &in, std::ostream &out);
  * @throws std::ios_base::failure on stream errors
  * @throws std::invalid_argument on invalid or corrupted input data
  */
-void decompress(std::istream &in, std::ostream &out);
+void decompress(std::istream &in, std::ostream &out,
+    const DecompressOptions &options = DecompressOptions());
+void decompress(
+    std::istream &in, Sink &out, const DecompressOptions &options = DecompressOptions());
+void decompress(Context &ctx, std::istream &in, Sink &out,
+    const DecompressOptions &options = DecompressOptions());
+
+/**
+ * Decompresses a block of LZW-compressed memory.
+ *
+ * The input is read in place without any intermediate copies.
+ *
+ * @throws std::ios_base::failure on stream errors
+ * @throws std::invalid_argument on invalid or corrupted input data
+ */
+void decompress(const void *src, size_t size, std::ostream &out,
+    const DecompressOptions &options = DecompressOptions());
+void decompress(const void *src, size_t size, Sink &out,
+    const DecompressOptions &options = DecompressOptions());
+void decompress(Context &ctx, const void *src, size_t size, Sink &out,
+    const DecompressOptions &options = DecompressOptions());
+
+/**
+ * Decompresses a block of LZW-compressed memory directly into a caller-supplied buffer.
+ *
+ * @return the number of bytes written to dst
+ * @throws std::invalid_argument on invalid or corrupted input data
+ * @throws std::length_error if the decompressed data does not fit into dst
+ */
+size_t decompress(const void *src, size_t size, void *dst, size_t capacity,
+    const DecompressOptions &options = DecompressOptions());
+size_t decompress(Context &ctx, const void *src, size_t size, void *dst, size_t capacity,
+    const DecompressOptions &options = DecompressOptions());
+
+/**
+ * A block of memory, one of the inputs of compress_many() and decompress_many().
+ */
+struct Buffer
+{
+  const void *data;
+  size_t size;
+};
+
+/**
+ * Compresses each of count blocks of memory into a stream of its own.
+ *
+ * The streams are passed on to out one after another in input order, without anything in
+ * between. Meant for many small inputs, for which the setup of a compress() call would
+ * cost more than the compression itself: a single context is used for all of them.
+ *
+ * With options.threads other than 1, the inputs are divided into runs of consecutive
+ * inputs of about equal total size that are compressed on multiple threads, each input
+ * on a single one. options.segment_size and options.index are not used.
+ *
+ * @return count + 1 offsets into the output, stream i being the bytes from offsets[i] to
+ *     offsets[i + 1]
+ * @throws std::invalid_argument on invalid options
+ */
+std::vector<size_t> compress_many(const Buffer *inputs, size_t count, Sink &out,
+    const CompressOptions &options = CompressOptions());
+std::vector<size_t> compress_many(Context &ctx, const Buffer *inputs, size_t count,
+    Sink &out, const CompressOptions &options = CompressOptions());
+
+/**
+ * Decompresses each of count blocks of LZW-compressed memory, the same way as
+ * compress_many(). options.index is not used.
+ *
+ * @return count + 1 offsets into the output, the decompressed data of input i being the
+ *     bytes from offsets[i] to offsets[i + 1]
+ * @throws std::invalid_argument on invalid options or invalid or corrupted input data,
+ *     with the number of the input in the message
+ */
+std::vector<size_t> decompress_many(const Buffer *inputs, size_t count, Sink &out,
+    const DecompressOptions &options = DecompressOptions());
+std::vector<size_t> decompress_many(Context &ctx, const Buffer *inputs, size_t count,
+    Sink &out, const DecompressOptions &options = DecompressOptions());
+
+/**
+ * Builds the index of a block of LZW-compressed memory.
+ *
+ * The codes are followed without decoding the data. This is also the fastest way to find
+ * the decompressed size.
+ *
+ * @throws std::invalid_argument on invalid or corrupted input data
+ */
+Index build_index(const void *src, size_t size);
+
+/**
+ * Writes an index in a portable binary format that read_index() reads back.
+ *
+ * The format consists of the signature "LZWI", a version byte of 1, three zero bytes and
+ * the compressed size, decompressed size and number of entries, followed by the
+ * in_offset and out_offset of each entry, all as 64-bit little-endian integers.
+ */
+void write_index(const Index &index, Sink &out);
+void write_index(const Index &index, std::ostream &out);
+
+/**
+ * Reads an index written by write_index().
+ *
+ * @throws std::invalid_argument if the data is not a valid index
+ */
+Index read_index(const void *data, size_t size);
+
+/**
+ * Decompresses length bytes of the decompressed data starting at offset.
+ *
+ * Decoding starts at the last segment of the index that begins at or before offset and
+ * stops once the range is complete, so the cost is proportional to the segment size
+ * rather than the offset. The range is truncated at the end of the data.
+ *
+ * @throws std::invalid_argument on invalid or corrupted input data or if the index does
+ *     not match it
+ */
+void decompress_range(const void *src, size_t size, const Index &index, size_t offset,
+    size_t length, Sink &out);
+void decompress_range(Context &ctx, const void *src, size_t size, const Index &index,
+    size_t offset, size_t length, Sink &out);
+
+/**
+ * Decompresses length bytes of the decompressed data starting at offset directly into a
+ * caller-supplied buffer of at least length bytes.
+ *
+ * @return the number of bytes written to dst, which is less than length if the range
+ *     extends past the end of the data
+ * @throws std::invalid_argument on invalid or corrupted input data or if the index does
+ *     not match it
+ */
+size_t decompress_range(const void *src, size_t size, const Index &index, size_t offset,
+    void *dst, size_t length);
+size_t decompress_range(Context &ctx, const void *src, size_t size, const Index &index,
+    size_t offset, void *dst, size_t length);
+
+/**
+ * Compresses a file into another one.
+ *
+ * Regular files are memory-mapped and compressed like a block of memory, from the current
+ * file position on. Other inputs such as pipes are read in chunks of options.read_size
+ * bytes and compressed like a std::istream. Either way, options.threads and
+ * options.segment_size apply, and the output is the same as for the data in memory. The
+ * output is written with write() calls of 1 MB to a temporary file in the directory of
+ * dst_path, which replaces the destination file once compression succeeds and is removed
+ * otherwise, so an existing destination is left as it was on failure. Other
+ * destinations, such as devices and FIFOs, are written to as they are. Paths are in UTF-8
+ * on Windows.
+ *
+ * The fd overloads read and write the given file descriptors, which are left open.
+ *
+ * @throws std::system_error if a file can not be opened, read or written
+ * @throws std::invalid_argument on invalid options
+ */
+void compress_file(const std::string &src_path, const std::string &dst_path,
+    const CompressOptions &options = CompressOptions());
+void compress_fd(
+    int src_fd, int dst_fd, const CompressOptions &options = CompressOptions());
+
+/**
+ * Decompresses a file into another one, the same way as compress_file().
+ *
+ * @throws std::system_error if a file can not be opened, read or written
+ * @throws std::invalid_argument on invalid or corrupted input data
+ */
+void decompress_file(const std::string &src_path, const std::string &dst_path,
+    const DecompressOptions &options = DecompressOptions());
+void decompress_fd(
+    int src_fd, int dst_fd, const DecompressOptions &options = DecompressOptions());
+
+/**
+ * Compresses data incrementally as it arrives.
+ *
+ * The output is passed on to the sink as it becomes available and is identical to that of
+ * compress() regardless of how the input is split into chunks. The compressor is finished
+ * by finish() or by any exception and can not be used any further after that.
+ */
+class Compressor
+{
+  public:
+  /**
+   * @throws std::invalid_argument on invalid options
+   */
+  explicit Compressor(Sink &out, const CompressOptions &options = CompressOptions());
+  ~Compressor();
+
+  Compressor(const Compressor &) = delete;
+  Compressor &operator=(const Compressor &) = delete;
+
+  /**
+   * Compresses the next chunk of input.
+   *
+   * @throws std::logic_error if already finished
+   */
+  void feed(const void *data, size_t size);
+
+  /**
+   * Writes out the remaining compressed data.
+   *
+   * @throws std::logic_error if already finished
+   */
+  void finish();
+
+  private:
+  struct Impl;
+  std::unique_ptr<Impl> impl;
+};
+
+/**
+ * Decompresses data incrementally as it arrives.
+ *
+ * All of the output that can be decoded from the input fed so far is passed on to the
+ * sink before feed() returns. The decompressor is finished by finish() or by any
+ * exception and can not be used any further after that.
+ */
+class Decompressor
+{
+  public:
+  /**
+   * @throws std::invalid_argument on invalid options
+   */
+  explicit Decompressor(
+      Sink &out, const DecompressOptions &options = DecompressOptions());
+  ~Decompressor();
+
+  Decompressor(const Decompressor &) = delete;
+  Decompressor &operator=(const Decompressor &) = delete;
+
+  /**
+   * Decompresses the next chunk of input.
+   *
+   * @throws std::invalid_argument on invalid or corrupted input data
+   * @throws std::logic_error if already finished
+   */
+  void feed(const void *data, size_t size);
+
+  /**
+   * Decodes the last remaining codes and checks that the input was complete.
+   *
+   * @throws std::invalid_argument on invalid or corrupted input data
+   * @throws std::logic_error if already finished
+   */
+  void finish();
+
+  private:
+  struct Impl;
+  std::unique_ptr<Impl> impl;
+};
 
 static const unsigned char MAGIC_1 = 0x1fU; /* First byte of compressed file */
 static const unsigned char MAGIC_2 = 0x9dU; /* Second byte of compressed file */
@@ -0,0 +1,674 @@
+/* File and file descriptor I/O of compress_file() and decompress_file(). Kept apart from
+ * ncompress.cpp to confine the platform headers to this file. */
+
+#include "ncompress.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <istream>
+#include <memory>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <system_error>
+
+#ifdef _WIN32
+#  ifndef NOMINMAX
+#    define NOMINMAX
+#  endif
+#  ifndef WIN32_LEAN_AND_MEAN
+#    define WIN32_LEAN_AND_MEAN
+#  endif
+#  include <fcntl.h>
+#  include <io.h>
+#  include <sys/stat.h>
+#  include <windows.h>
+#else
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+namespace ncompress
+{
+
+namespace
+{
+
+const size_t FILE_CHUNK = 1 << 20; /* Size of the write() calls */
+
+/* Throws the error of the last failed system call */
+[[noreturn]] void
+system_error(const std::string &what)
+{
+  throw std::system_error(errno, std::generic_category(), what);
+}
+
+/*
+ * Platform helpers. stat_path() returns the type of the file at path, following symbolic
+ * links, and sets mode to its permission bits if it exists. copy_mode() gives a file
+ * these permissions.
+ */
+enum class file_type
+{
+  missing,
+  regular,
+  other
+};
+
+#ifdef _WIN32
+
+std::wstring
+widen(const std::string &path)
+{
+  int n = MultiByteToWideChar(CP_UTF8, 0, path.c_str(), -1, nullptr, 0);
+  std::wstring wide(n > 0 ? (size_t)n : 1, L'\0');
+  if (n == 0 || MultiByteToWideChar(CP_UTF8, 0, path.c_str(), -1, &wide[0], n) == 0)
+    wide.clear();
+  return wide;
+}
+
+int
+open_file(const std::string &path, int flags)
+{
+  std::wstring wide = widen(path);
+  if (wide.empty())
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  return _wopen(wide.c_str(), flags | _O_BINARY | _O_NOINHERIT, _S_IREAD | _S_IWRITE);
+}
+
+int
+open_input(const std::string &path)
+{
+  return open_file(path, _O_RDONLY);
+}
+
+int
+open_output(const std::string &path)
+{
+  return open_file(path, _O_WRONLY);
+}
+
+/* Creates a new file, failing with EEXIST if there is one */
+int
+create_file(const std::string &path)
+{
+  return open_file(path, _O_WRONLY | _O_CREAT | _O_EXCL);
+}
+
+file_type
+stat_path(std::string &path, int &mode)
+{
+  struct _stat64 st;
+  if (_wstat64(widen(path).c_str(), &st) != 0)
+    return file_type::missing;
+  mode = st.st_mode;
+  return (st.st_mode & _S_IFREG) ? file_type::regular : file_type::other;
+}
+
+int
+copy_mode(int, int)
+{
+  return 0;
+}
+
+int
+replace_file(const std::string &from, const std::string &to)
+{
+  if (MoveFileExW(widen(from).c_str(), widen(to).c_str(), MOVEFILE_REPLACE_EXISTING))
+    return 0;
+  errno = GetLastError() == ERROR_ACCESS_DENIED ? EACCES : EIO;
+  return -1;
+}
+
+void
+remove_file(const std::string &path)
+{
+  _wunlink(widen(path).c_str());
+}
+
+int
+close_file(int fd)
+{
+  return _close(fd);
+}
+
+long long
+read_some(int fd, void *buf, size_t size)
+{
+  return _read(fd, buf, (unsigned)std::min(size, (size_t)INT_MAX));
+}
+
+long long
+write_some(int fd, const void *buf, size_t size)
+{
+  return _write(fd, buf, (unsigned)std::min(size, (size_t)INT_MAX));
+}
+
+bool
+same_file(int fd1, int fd2)
+{
+  BY_HANDLE_FILE_INFORMATION a, b;
+  return GetFileInformationByHandle((HANDLE)_get_osfhandle(fd1), &a) &&
+      GetFileInformationByHandle((HANDLE)_get_osfhandle(fd2), &b) &&
+      a.dwVolumeSerialNumber == b.dwVolumeSerialNumber &&
+      a.nFileIndexHigh == b.nFileIndexHigh && a.nFileIndexLow == b.nFileIndexLow;
+}
+
+#else
+
+int
+open_file(const std::string &path, int flags)
+{
+#  ifdef O_CLOEXEC
+  flags |= O_CLOEXEC;
+#  endif
+  int fd;
+  do
+    fd = ::open(path.c_str(), flags, 0666);
+  while (fd < 0 && errno == EINTR);
+  return fd;
+}
+
+int
+open_input(const std::string &path)
+{
+  return open_file(path, O_RDONLY);
+}
+
+int
+open_output(const std::string &path)
+{
+  return open_file(path, O_WRONLY);
+}
+
+/* Creates a new file, failing with EEXIST if there is one */
+int
+create_file(const std::string &path)
+{
+  return open_file(path, O_WRONLY | O_CREAT | O_EXCL);
+}
+
+/* A symbolic link is resolved, so that the file it points to is replaced */
+file_type
+stat_path(std::string &path, int &mode)
+{
+  struct stat st;
+  if (::lstat(path.c_str(), &st) == 0 && S_ISLNK(st.st_mode))
+  {
+    if (char *real = ::realpath(path.c_str(), nullptr))
+    {
+      path = real;
+      free(real);
+    }
+  }
+  if (::stat(path.c_str(), &st) != 0)
+    return file_type::missing;
+  mode = st.st_mode & 07777;
+  return S_ISREG(st.st_mode) ? file_type::regular : file_type::other;
+}
+
+int
+copy_mode(int fd, int mode)
+{
+  return ::fchmod(fd, (mode_t)mode);
+}
+
+int
+replace_file(const std::string &from, const std::string &to)
+{
+  return ::rename(from.c_str(), to.c_str());
+}
+
+void
+remove_file(const std::string &path)
+{
+  ::unlink(path.c_str());
+}
+
+int
+close_file(int fd)
+{
+  return ::close(fd);
+}
+
+long long
+read_some(int fd, void *buf, size_t size)
+{
+  ssize_t n;
+  do
+    n = ::read(fd, buf, std::min(size, (size_t)SSIZE_MAX));
+  while (n < 0 && errno == EINTR);
+  return n;
+}
+
+long long
+write_some(int fd, const void *buf, size_t size)
+{
+  ssize_t n;
+  do
+    n = ::write(fd, buf, std::min(size, (size_t)SSIZE_MAX));
+  while (n < 0 && errno == EINTR);
+  return n;
+}
+
+bool
+same_file(int fd1, int fd2)
+{
+  struct stat a, b;
+  return ::fstat(fd1, &a) == 0 && ::fstat(fd2, &b) == 0 && a.st_dev == b.st_dev &&
+      a.st_ino == b.st_ino;
+}
+
+#endif
+
+/*
+ * The rest of an input file from its current position, memory-mapped if it is a regular
+ * file. Like any mapping, it must not be truncated by another process while in use.
+ */
+class mapped_input
+{
+  public:
+  explicit mapped_input(int fd);
+  ~mapped_input();
+
+  mapped_input(const mapped_input &) = delete;
+  mapped_input &operator=(const mapped_input &) = delete;
+
+  bool mapped() const { return data != nullptr; }
+
+  /* Moves the file position to the end, as if the input had been read */
+  void consume();
+
+  const char *data = nullptr;
+  size_t size = 0;
+
+  private:
+  int fd;
+  void *base = nullptr; /* The mapping of the whole file */
+  size_t base_size = 0;
+  std::int64_t end = 0; /* File size */
+#ifdef _WIN32
+  HANDLE mapping = nullptr;
+#endif
+};
+
+#ifdef _WIN32
+
+mapped_input::mapped_input(int fd)
+    : fd(fd)
+{
+  struct _stat64 st;
+  if (_fstat64(fd, &st) != 0 || !(st.st_mode & _S_IFREG))
+    return;
+  std::int64_t pos = _lseeki64(fd, 0, SEEK_CUR);
+  if (pos < 0 || pos > st.st_size || (std::uint64_t)st.st_size > SIZE_MAX)
+    return;
+  end = st.st_size;
+  if (pos == end)
+  { /* Nothing to map */
+    data = "";
+    return;
+  }
+
+  mapping = CreateFileMappingW(
+      (HANDLE)_get_osfhandle(fd), nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (!mapping)
+    return;
+  base = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if (!base)
+    return;
+  base_size = (size_t)end;
+  data = (const char *)base + pos;
+  size = (size_t)(end - pos);
+}
+
+mapped_input::~mapped_input()
+{
+  if (base)
+    UnmapViewOfFile(base);
+  if (mapping)
+    CloseHandle(mapping);
+}
+
+void
+mapped_input::consume()
+{
+  _lseeki64(fd, end, SEEK_SET);
+}
+
+#else
+
+mapped_input::mapped_input(int fd)
+    : fd(fd)
+{
+  struct stat st;
+  if (::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+    return;
+  off_t pos = ::lseek(fd, 0, SEEK_CUR);
+  if (pos < 0 || pos > st.st_size || (std::uint64_t)st.st_size > SIZE_MAX)
+    return;
+  end = st.st_size;
+  if (pos == end)
+  { /* Nothing to map */
+    data = "";
+    return;
+  }
+
+  void *p = ::mmap(nullptr, (size_t)end, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (p == MAP_FAILED)
+    return;
+#  ifdef MADV_SEQUENTIAL
+  ::madvise(p, (size_t)end, MADV_SEQUENTIAL);
+#  endif
+  base = p;
+  base_size = (size_t)end;
+  data = (const char *)base + pos;
+  size = (size_t)(end - pos);
+}
+
+mapped_input::~mapped_input()
+{
+  if (base)
+    ::munmap(base, base_size);
+}
+
+void
+mapped_input::consume()
+{
+  ::lseek(fd, (off_t)end, SEEK_SET);
+}
+
+#endif
+
+/* Writes the output to a file descriptor in chunks of FILE_CHUNK bytes */
+class fd_sink : public Sink
+{
+  public:
+  explicit fd_sink(int fd)
+      : fd(fd)
+      , buf(new char[FILE_CHUNK])
+  {
+  }
+
+  void write(const char *data, size_t size) override
+  {
+    if (used + size > FILE_CHUNK)
+      flush();
+    if (size >= FILE_CHUNK)
+      write_all(data, size);
+    else
+    {
+      memcpy(buf.get() + used, data, size);
+      used += size;
+    }
+  }
+
+  void flush()
+  {
+    write_all(buf.get(), used);
+    used = 0;
+  }
+
+  private:
+  int fd;
+  std::unique_ptr<char[]> buf;
+  size_t used = 0;
+
+  void write_all(const char *data, size_t size)
+  {
+    while (size > 0)
+    {
+      long long n = write_some(fd, data, size);
+      if (n < 0)
+        system_error("writing to file failed");
+      data += n;
+      size -= (size_t)n;
+    }
+  }
+};
+
+/* Feeds the input from a file descriptor to a Compressor or Decompressor and finishes
+ * it */
+template <class Coder>
+void
+feed_fd(int fd, Coder &coder, size_t read_size)
+{
+  std::unique_ptr<char[]> buf(new char[read_size]);
+  for (;;)
+  {
+    long long n = read_some(fd, buf.get(), read_size);
+    if (n < 0)
+      system_error("reading from file failed");
+    if (n == 0)
+      break;
+    coder.feed(buf.get(), (size_t)n);
+  }
+  coder.finish();
+}
+
+/* Reads a file descriptor as a std::istream, for the segmented compression of inputs
+ * that can not be mapped. Large reads go straight into the caller's buffer. */
+class fd_streambuf : public std::streambuf
+{
+  public:
+  fd_streambuf(int fd, size_t read_size)
+      : fd(fd)
+      , buf(new char[read_size])
+      , buf_size(read_size)
+  {
+  }
+
+  protected:
+  int_type underflow() override
+  {
+    long long n = read_fd(buf.get(), buf_size);
+    if (n == 0)
+      return traits_type::eof();
+    setg(buf.get(), buf.get(), buf.get() + n);
+    return traits_type::to_int_type(buf[0]);
+  }
+
+  std::streamsize xsgetn(char *s, std::streamsize count) override
+  {
+    std::streamsize done = 0;
+    while (done < count)
+    {
+      std::streamsize n = std::min<std::streamsize>(egptr() - gptr(), count - done);
+      if (n > 0)
+      {
+        memcpy(s + done, gptr(), (size_t)n);
+        gbump((int)n);
+      }
+      else if ((n = (std::streamsize)read_fd(s + done, (size_t)(count - done))) == 0)
+        break;
+      done += n;
+    }
+    return done;
+  }
+
+  private:
+  int fd;
+  std::unique_ptr<char[]> buf;
+  size_t buf_size;
+
+  long long read_fd(char *data, size_t size)
+  {
+    long long n = read_some(fd, data, size);
+    if (n < 0)
+      system_error("reading from file failed");
+    return n;
+  }
+};
+
+void
+check_read_size(size_t read_size)
+{
+  if (read_size == 0 || read_size > MAX_BUFFER_SIZE)
+  {
+    throw std::invalid_argument(
+        "read_size must be between 1 and " + std::to_string(MAX_BUFFER_SIZE));
+  }
+}
+
+/* Creates a temporary file next to path, named path.N.tmp, and sets temp to its name */
+int
+create_temp(const std::string &path, std::string &temp)
+{
+  for (int n = 0; n < 100; n++)
+  {
+    std::string name = path + "." + std::to_string(n) + ".tmp";
+    int fd = create_file(name);
+    if (fd >= 0)
+    {
+      temp = name;
+      return fd;
+    }
+    if (errno != EEXIST)
+      break;
+  }
+  return -1;
+}
+
+/* Whether fd refers to the file at path, which is false if it cannot be opened */
+bool
+same_file(int fd, const std::string &path)
+{
+  int path_fd = open_input(path);
+  if (path_fd < 0)
+    return false;
+  bool same = same_file(fd, path_fd);
+  close_file(path_fd);
+  return same;
+}
+
+/*
+ * Runs f(src_fd, dst_fd) on the opened files. A regular destination file is written to a
+ * temporary file in the same directory, which replaces it once f succeeds and is removed
+ * otherwise, so that a failure leaves an existing destination as it was. Other
+ * destinations, such as devices and FIFOs, are written to as they are.
+ */
+template <class F>
+void
+with_files(const std::string &src_path, const std::string &dst_path, F f)
+{
+  int src_fd = open_input(src_path);
+  if (src_fd < 0)
+    system_error("cannot open " + src_path);
+  std::string target = dst_path, temp;
+  int mode = 0;
+  const file_type type = stat_path(target, mode);
+  int dst_fd = -1;
+  try
+  {
+    bool same;
+    if (type == file_type::other)
+    {
+      if ((dst_fd = open_output(target)) < 0)
+        system_error("cannot open " + dst_path);
+      same = same_file(src_fd, dst_fd);
+    }
+    else
+      same = type == file_type::regular && same_file(src_fd, target);
+    if (same)
+      throw std::invalid_argument(src_path + " and " + dst_path + " are the same file");
+    if (type != file_type::other)
+    {
+      if ((dst_fd = create_temp(target, temp)) < 0)
+        system_error("cannot create " + dst_path);
+      if (type == file_type::regular && copy_mode(dst_fd, mode) != 0)
+        system_error("cannot create " + dst_path);
+    }
+    f(src_fd, dst_fd);
+    int fd = dst_fd;
+    dst_fd = -1;
+    if (close_file(fd) != 0)
+      system_error("writing to " + dst_path + " failed");
+    if (!temp.empty() && replace_file(temp, target) != 0)
+      system_error("cannot replace " + dst_path);
+  }
+  catch (...)
+  {
+    close_file(src_fd);
+    if (dst_fd >= 0)
+      close_file(dst_fd);
+    if (!temp.empty())
+      remove_file(temp);
+    throw;
+  }
+  close_file(src_fd);
+}
+
+} // namespace
+
+void
+compress_fd(int src_fd, int dst_fd, const CompressOptions &options)
+{
+  fd_sink out(dst_fd);
+  mapped_input in(src_fd);
+  if (in.mapped())
+  {
+    compress(in.data, in.size, out, options);
+    in.consume();
+  }
+  else if (options.threads != 1)
+  { /* Compressed in segments like a block of memory, which Compressor does not do */
+    check_read_size(options.read_size);
+    fd_streambuf buf(src_fd, options.read_size);
+    std::istream stream(&buf);
+    stream.exceptions(std::ios::badbit); /* Pass the system_error of a failed read on */
+    compress(stream, out, options);
+  }
+  else
+  {
+    check_read_size(options.read_size);
+    Compressor coder(out, options);
+    feed_fd(src_fd, coder, options.read_size);
+  }
+  out.flush();
+}
+
+void
+decompress_fd(int src_fd, int dst_fd, const DecompressOptions &options)
+{
+  fd_sink out(dst_fd);
+  mapped_input in(src_fd);
+  if (in.mapped())
+  {
+    decompress(in.data, in.size, out, options);
+    in.consume();
+  }
+  else
+  {
+    check_read_size(options.read_size);
+    Decompressor coder(out, options);
+    feed_fd(src_fd, coder, options.read_size);
+  }
+  out.flush();
+}
+
+void
+compress_file(const std::string &src_path, const std::string &dst_path,
+    const CompressOptions &options)
+{
+  with_files(src_path, dst_path,
+      [&](int src_fd, int dst_fd) { compress_fd(src_fd, dst_fd, options); });
+}
+
+void
+decompress_file(const std::string &src_path, const std::string &dst_path,
+    const DecompressOptions &options)
+{
+  with_files(src_path, dst_path,
+      [&](int src_fd, int dst_fd) { decompress_fd(src_fd, dst_fd, options); });
+}
+
+} // namespace ncompress
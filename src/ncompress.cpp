@@ -15,24 +15,55 @@
 
 #include "ncompress.h"
 
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
 #include <cstdio>
 #include <cstring>
+#include <exception>
 #include <istream>
+#include <limits>
+#include <memory>
+#include <mutex>
 #include <ostream>
+#include <stdexcept>
 #include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BUCKET_SSE2 1
+#include <emmintrin.h>
+#else
+#define BUCKET_SSE2 0
+#endif
 
-namespace ncompress
-{
-
-#ifndef IBUFSIZ
-#  define IBUFSIZ BUFSIZ /* Default input buffer size */
+/* The AVX2 scan is compiled with a target attribute and chosen at run time. The other
+ * hot loops (code packing and unpacking, hash probing, string copies) are built for the
+ * baseline only: instances of them for SSE4.2 and for AVX2 with BMI2 (shlx, shrx) were
+ * no faster, within the noise of the code layout changing between builds. */
+#if BUCKET_SSE2 && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BUCKET_AVX2 1
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#include <immintrin.h>
+#else
+#define BUCKET_AVX2 0
 #endif
-#ifndef OBUFSIZ
-#  define OBUFSIZ BUFSIZ /* Default output buffer size */
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define ALWAYS_INLINE __forceinline
+#else
+#define ALWAYS_INLINE inline __attribute__((always_inline))
 #endif
 
+namespace ncompress
+{
+
 using code_int = long;
-using count_int = long;
+using hslot_type = std::uint32_t;
 using cmp_code_int = long;
 using char_type = unsigned char;
 using codetab_type = unsigned short;
@@ -52,12 +83,17 @@ const code_int CLEAR = 256; /* table clear output code */
 
 const int INIT_BITS = 9; /* initial number of bits/code */
 
-const int HBITS = 17; /* 50% occupancy */
-const int HSIZE = 1 << HBITS;
-const int HMASK = HSIZE - 1;
-const int BITS = 16;
+const int BITS = MAX_BITS;
 
-const long CHECK_GAP = 10000;
+/* Longest interval of a ResetPolicy, so that bytes_in plus an interval does not overflow.
+ * Also stands for never. */
+const long MAX_GAP = std::numeric_limits<long>::max() / 2;
+
+/* Hash table slots pack the probe number (top 8 bits), the character (next 8 bits) and
+ * the code (low 16 bits) of an entry, with 0 meaning empty. */
+const hslot_type PROBE_ONE = 1U << 24; /* Probe number increment, starting from 1 */
+const hslot_type PROBE_MAX = 0xffU << 24; /* Last probe number, full key in ovf_key */
+const hslot_type PROBE_FAST_END = PROBE_MAX - 3 * PROBE_ONE; /* For the unrolled lookup */
 
 constexpr code_int
 MAXCODE(int n)
@@ -65,6 +101,31 @@ MAXCODE(int n)
   return 1L << n;
 }
 
+const int MIN_HBITS = 12; /* log2 of the smallest hash table size */
+
+/* log2 of the hash table size needed for maxbits. The table has 8 << maxbits slots for
+ * 12.5% occupancy, capped at 50% for 16 bits. Small tables fill up quickly and probe
+ * sequences get long otherwise. */
+int
+full_hash_bits(int maxbits)
+{
+  return std::min(maxbits + 3, MAX_BITS + 1);
+}
+
+/* log2 of the hash table size for an input of about size_hint bytes, 0 if unknown. Every
+ * input byte adds at most one code, which keeps the table at most 25% full. */
+int
+hash_bits(int maxbits, size_t size_hint)
+{
+  int full = full_hash_bits(maxbits);
+  if (size_hint == 0)
+    return full;
+  int hbits = MIN_HBITS;
+  while (hbits < full && ((size_t)1 << (hbits - 2)) < size_hint)
+    ++hbits;
+  return hbits;
+}
+
 void
 output(char_type *buf, int &bits, code_int code, int n_bits)
 {
@@ -77,15 +138,133 @@ output(char_type *buf, int &bits, code_int code, int n_bits)
 }
 
 code_int
-input(char_type *buf, int &bits, int n_bits, int bitmask)
+input(const char_type *buf, int &bits, int n_bits, int bitmask)
 {
-  char_type *p = &buf[bits >> 3];
+  const char_type *p = &buf[bits >> 3];
   long i = ((long)(p[0])) | ((long)(p[1]) << 8) | ((long)(p[2]) << 16);
   code_int code = (i >> (bits & 0x7)) & bitmask;
   bits += n_bits;
   return code;
 }
 
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define LITTLE_ENDIAN_WORDS 1
+#elif defined(_MSC_VER)
+#define LITTLE_ENDIAN_WORDS 1
+#else
+#define LITTLE_ENDIAN_WORDS 0
+#endif
+
+/* Loads 8 little-endian bytes from a possibly unaligned address */
+std::uint64_t
+load_le64(const char_type *p)
+{
+#if LITTLE_ENDIAN_WORDS
+  std::uint64_t word;
+  memcpy(&word, p, 8);
+  return word;
+#else
+  std::uint64_t word = 0;
+  for (int i = 7; i >= 0; --i)
+    word = (word << 8) | p[i];
+  return word;
+#endif
+}
+
+/* Stores 8 little-endian bytes to a possibly unaligned address */
+void
+store_le64(char_type *p, std::uint64_t word)
+{
+#if LITTLE_ENDIAN_WORDS
+  memcpy(p, &word, 8);
+#else
+  for (int i = 0; i < 8; ++i, word >>= 8)
+    p[i] = (char_type)word;
+#endif
+}
+
+/* Copies 1 to 16 bytes that do not overlap with two loads and two stores of the same
+ * width, which overlap each other for sizes in between, instead of calling memcpy() */
+void
+copy_short(char_type *dst, const char_type *src, size_t n)
+{
+  if (n >= 8)
+  {
+    std::uint64_t head, tail;
+    memcpy(&head, src, 8);
+    memcpy(&tail, src + n - 8, 8);
+    memcpy(dst, &head, 8);
+    memcpy(dst + n - 8, &tail, 8);
+  }
+  else if (n >= 4)
+  {
+    std::uint32_t head, tail;
+    memcpy(&head, src, 4);
+    memcpy(&tail, src + n - 4, 4);
+    memcpy(dst, &head, 4);
+    memcpy(dst + n - 4, &tail, 4);
+  }
+  else
+  {
+    dst[0] = src[0];
+    dst[n / 2] = src[n / 2];
+    dst[n - 1] = src[n - 1];
+  }
+}
+
+/*
+ * Like output(), but the bits from accpos on are kept in acc and stored to buf 32 at a
+ * time. accpos is a multiple of 32. Moving bits on for padding leaves zeros in acc,
+ * which spill_words() then stores. The bits in acc only reach buf with sync_words().
+ */
+void
+output_word(char_type *buf, std::uint64_t &acc, int &accpos, int &bits, code_int code,
+            int n_bits)
+{
+  acc |= (std::uint64_t)code << (bits - accpos);
+  bits += n_bits;
+  if (bits - accpos >= 32)
+  {
+    store_le64(&buf[accpos >> 3], acc);
+    acc >>= 32;
+    accpos += 32;
+  }
+}
+
+void
+spill_words(char_type *buf, std::uint64_t &acc, int &accpos, int bits)
+{
+  while (bits - accpos >= 32)
+  {
+    store_le64(&buf[accpos >> 3], acc);
+    acc >>= 32;
+    accpos += 32;
+  }
+}
+
+void
+sync_words(char_type *buf, std::uint64_t acc, int accpos)
+{
+  store_le64(&buf[accpos >> 3], acc);
+}
+
+/* Loads the accumulator for continuing output() at bits. Bits past it must be zero. */
+void
+load_words(const char_type *buf, std::uint64_t &acc, int &accpos, int bits)
+{
+  accpos = bits & ~31;
+  acc = load_le64(&buf[accpos >> 3]);
+}
+
+/* Like input(), but with a single load of the 8 bytes from the code on */
+code_int
+input_word(const char_type *buf, int &bits, int n_bits, int bitmask)
+{
+  code_int code = (code_int)(load_le64(&buf[bits >> 3]) >> (bits & 0x7)) & bitmask;
+  bits += n_bits;
+  return code;
+}
+
 void
 reset_n_bits_for_compressor(
     int &n_bits, int &stcode, code_int &free_ent, code_int &extcode, int maxbits)
@@ -145,467 +324,2810 @@ static const int primetab[256] = /* Special secudary hash table.		*/
     };
 /* clang-format on */
 
-void read_error();
-void write_error();
+/* The slots of a Dictionary::bucketed table are grouped into buckets of one cache line.
+ * A bucket is filled in order, so its first empty slot ends the search for a key. The
+ * key of the string (ent, c) is ent << 8 | c | BUCKET_USED, with 0 meaning empty. A key
+ * that does not fit into its bucket goes to the next one. */
+const int BUCKET_SLOTS = 8;
+const std::uint32_t BUCKET_USED = 1U << 24;
+const std::uint32_t BUCKET_MULT = 0x9e3779b1U; /* Spreads the keys over the buckets */
 
-/*
- * Compress in stream to out stream.
- *
- * Algorithm:  use open addressing double hashing (no chaining) on the
- * prefix code / next character combination.  We do a variant of Knuth's
- * algorithm D (vol. 3, sec. 6.4) along with G. Knott's relatively-prime
- * secondary probe.  Here, the modular division first probe is gives way
- * to a faster exclusive-or manipulation.  Also do block compression with
- * an adaptive reset, whereby the code table is cleared when the compression
- * ratio decreases, but after the table fills.  The variable-length output
- * codes are re-sized at this point, and a special CLEAR code is generated
- * for the decompressor.  Late addition:  construct the table according to
- * file size for noticeable speed improvement on small files.  Please direct
- * questions about this implementation to ames!jaw. */
-void
-compress(std::istream &in, std::ostream &out)
+struct bucket
 {
-  char_type inbuf[IBUFSIZ + 64]; /* Input buffer */
-  char_type outbuf[OBUFSIZ + 2048]; /* Output buffer */
-
-  long bytes_in = 0; /* Total number of bytes from input */
-  long bytes_out = 0; /* Total number of bytes to output */
+  std::uint32_t key[BUCKET_SLOTS];
+  std::uint16_t code[BUCKET_SLOTS];
+  std::uint32_t unused[4]; /* Pads the bucket to 64 bytes */
+};
 
-  count_int htab[HSIZE];
-  unsigned short codetab[HSIZE];
+const int MIN_BBITS = 8; /* log2 of the smallest number of buckets */
 
-  auto clear_htab = [&]() { memset(htab, -1, sizeof(htab)); };
-
-  int n_bits;
-  int stcode;
-  code_int free_ent;
-  code_int extcode;
-  int maxbits = BITS; /* user settable max # bits/code */
-  reset_n_bits_for_compressor(n_bits, stcode, free_ent, extcode, maxbits);
-  int ratio = 0;
-  long checkpoint = CHECK_GAP;
-  union
-  {
-    long code = 0;
-    struct
-    {
-      char_type c;
-      unsigned short ent;
-    } e;
-  } fcode;
+/* log2 of the number of buckets needed for maxbits, which keeps them at most half full */
+int
+full_bucket_bits(int maxbits)
+{
+  return std::max(maxbits - 2, MIN_BBITS);
+}
 
-  memset(outbuf, 0, sizeof(outbuf));
-  outbuf[0] = MAGIC_1;
-  outbuf[1] = MAGIC_2;
-  outbuf[2] = (char_type)(maxbits | BLOCK_MODE);
-  int outbits = 3 << 3;
-  int boff = outbits;
+/* log2 of the number of buckets for an input of about size_hint bytes, 0 if unknown */
+int
+bucket_bits(int maxbits, size_t size_hint)
+{
+  int full = full_bucket_bits(maxbits);
+  if (size_hint == 0)
+    return full;
+  int bbits = MIN_BBITS;
+  while (bbits < full && ((size_t)BUCKET_SLOTS << (bbits - 1)) < size_hint)
+    ++bbits;
+  return bbits;
+}
 
-  clear_htab();
+/* Index of the lowest set bit of a non-zero mask */
+inline int
+lowest_bit(unsigned mask)
+{
+#if defined(_MSC_VER)
+  unsigned long index;
+  _BitScanForward(&index, mask);
+  return (int)index;
+#else
+  return __builtin_ctz(mask);
+#endif
+}
 
-  while (in.good())
+/* Searches of a bucket for a key. find() returns the slot of the key, BUCKET_SLOTS plus
+ * the first empty slot if the key is not in the bucket, or 2 * BUCKET_SLOTS if the
+ * bucket is full. */
+struct scalar_scan
+{
+  static int find(const bucket &b, std::uint32_t key)
   {
-    in.read((char *)inbuf, IBUFSIZ);
-    int rsize = (int)in.gcount();
-    if (rsize <= 0)
-      break;
-
-    int rpos = 0;
-    if (bytes_in == 0)
+    for (int k = 0; k < BUCKET_SLOTS; ++k)
     {
-      fcode.e.ent = inbuf[0];
-      rpos = 1;
+      if (b.key[k] == key)
+        return k;
+      if (b.key[k] == 0)
+        return BUCKET_SLOTS + k;
     }
+    return 2 * BUCKET_SLOTS;
+  }
+};
 
-    int rlop = 0;
-
-    do
-    {
-      if (free_ent >= extcode && fcode.e.ent < FIRST)
-      {
-        if (n_bits < maxbits)
-        {
-          outbits = (outbits - 1) +
-              ((n_bits << 3) - ((outbits - boff - 1 + (n_bits << 3)) % (n_bits << 3)));
-          boff = outbits;
-          ++n_bits;
-          extcode = (n_bits < maxbits) ? MAXCODE(n_bits) + 1 : MAXCODE(n_bits);
-        }
-        else
-        {
-          extcode = MAXCODE(16) + OBUFSIZ;
-          stcode = 0;
-        }
-      }
+#if BUCKET_SSE2
+struct sse2_scan
+{
+  static int find(const bucket &b, std::uint32_t key)
+  {
+    __m128i lo = _mm_load_si128((const __m128i *)b.key);
+    __m128i hi = _mm_load_si128((const __m128i *)b.key + 1);
+    __m128i k = _mm_set1_epi32((int)key);
+    __m128i zero = _mm_setzero_si128();
+    /* Two mask bits per slot */
+    __m128i found = _mm_packs_epi32(_mm_cmpeq_epi32(lo, k), _mm_cmpeq_epi32(hi, k));
+    unsigned mask = (unsigned)_mm_movemask_epi8(found);
+    if (mask)
+      return lowest_bit(mask) / 2;
+    __m128i empty = _mm_packs_epi32(_mm_cmpeq_epi32(lo, zero), _mm_cmpeq_epi32(hi, zero));
+    mask = (unsigned)_mm_movemask_epi8(empty);
+    return BUCKET_SLOTS + lowest_bit(mask | 1U << (2 * BUCKET_SLOTS)) / 2;
+  }
+};
+typedef sse2_scan default_scan;
+#else
+typedef scalar_scan default_scan;
+#endif
 
-      if (!stcode && bytes_in >= checkpoint && fcode.e.ent < FIRST)
-      {
-        long int rat;
+#if BUCKET_AVX2
+struct avx2_scan
+{
+  TARGET_AVX2 static int find(const bucket &b, std::uint32_t key)
+  {
+    __m256i keys = _mm256_load_si256((const __m256i *)b.key);
+    __m256i found = _mm256_cmpeq_epi32(keys, _mm256_set1_epi32((int)key));
+    unsigned mask = (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(found));
+    if (mask)
+      return lowest_bit(mask);
+    __m256i empty = _mm256_cmpeq_epi32(keys, _mm256_setzero_si256());
+    mask = (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(empty));
+    return BUCKET_SLOTS + lowest_bit(mask | 1U << BUCKET_SLOTS);
+  }
+};
 
-        checkpoint = bytes_in + CHECK_GAP;
+/* Whether the CPU supports AVX2, checked once */
+bool
+have_avx2()
+{
+  static const bool avx2 = (__builtin_cpu_init(), __builtin_cpu_supports("avx2"));
+  return avx2;
+}
+#endif
 
-        if (bytes_in > 0x007fffff)
-        { /* shift will overflow */
-          rat = (bytes_out + (outbits >> 3)) >> 8;
+void read_error();
+void write_error();
 
-          if (rat == 0) /* Don't divide by zero */
-            rat = 0x7fffffff;
-          else
-            rat = bytes_in / rat;
-        }
-        else
-          rat = (bytes_in << 8) / (bytes_out + (outbits >> 3)); /* 8 fractional bits */
-        if (rat >= ratio)
-          ratio = (int)rat;
-        else
-        {
-          ratio = 0;
-          clear_htab();
-          output(outbuf, outbits, CLEAR, n_bits);
-          outbits = (outbits - 1) +
-              ((n_bits << 3) - ((outbits - boff - 1 + (n_bits << 3)) % (n_bits << 3)));
-          boff = outbits;
-          reset_n_bits_for_compressor(n_bits, stcode, free_ent, extcode, maxbits);
-        }
-      }
+/* Checks the read_size or write_size option */
+void
+check_buffer_size(const char *name, size_t size)
+{
+  if (size == 0 || size > MAX_BUFFER_SIZE)
+  {
+    throw std::invalid_argument(std::string(name) + " must be between 1 and " +
+        std::to_string(MAX_BUFFER_SIZE));
+  }
+}
 
-      if (outbits >= (OBUFSIZ << 3))
-      {
-        out.write((char *)outbuf, OBUFSIZ);
-        if (out.fail())
-          write_error();
+namespace
+{
 
-        outbits -= (OBUFSIZ << 3);
-        boff = -(((OBUFSIZ << 3) - boff) % (n_bits << 3));
-        bytes_out += OBUFSIZ;
+/* Passes the output on to a std::ostream. */
+class ostream_sink : public Sink
+{
+  public:
+  explicit ostream_sink(std::ostream &out)
+      : out(out)
+  {
+  }
 
-        memcpy(outbuf, outbuf + OBUFSIZ, (outbits >> 3) + 1);
-        memset(outbuf + (outbits >> 3) + 1, '\0', OBUFSIZ);
-      }
+  void write(const char *data, size_t size) override
+  {
+    out.write(data, (std::streamsize)size);
+    if (out.fail())
+      write_error();
+  }
 
-      {
-        int i = rsize - rlop;
+  private:
+  std::ostream &out;
+};
 
-        if ((code_int)i > extcode - free_ent)
-          i = (int)(extcode - free_ent);
-        if (i > (((int)sizeof(outbuf) - 32) * 8 - outbits) / n_bits)
-          i = (((int)sizeof(outbuf) - 32) * 8 - outbits) / n_bits;
+/* Adds the counts of from to those of to */
+void
+add_counts(Stats &to, const Stats &from)
+{
+  to.bytes_in += from.bytes_in;
+  to.bytes_out += from.bytes_out;
+  to.codes += from.codes;
+  to.clears += from.clears;
+  to.width_changes += from.width_changes;
+  to.probes += from.probes;
+}
 
-        if (!stcode && (long)i > checkpoint - bytes_in)
-          i = (int)(checkpoint - bytes_in);
+typedef std::chrono::steady_clock stats_clock;
 
-        rlop += i;
-        bytes_in += i;
-      }
+double
+seconds_since(stats_clock::time_point start)
+{
+  return std::chrono::duration<double>(stats_clock::now() - start).count();
+}
 
-      {
-        long hp;
-
-        goto next;
-      hfound:
-        fcode.e.ent = codetab[hp];
-      next:
-        if (rpos >= rlop)
-          goto endlop;
-      next2:
-        fcode.e.c = inbuf[rpos++];
-        {
-          long fc = fcode.code;
-          hp = (((long)(fcode.e.c)) << (HBITS - 8)) ^ (long)(fcode.e.ent);
+/* Adds the time until it goes out of scope to the io_seconds of stats, if set */
+class io_timer
+{
+  public:
+  explicit io_timer(Stats *stats)
+      : stats(stats)
+  {
+    if (stats)
+      start = stats_clock::now();
+  }
 
-          long i = htab[hp];
-          if (i == fc)
-            goto hfound;
-          if (i == -1)
-            goto out;
+  ~io_timer()
+  {
+    if (stats)
+      stats->io_seconds += seconds_since(start);
+  }
 
-          long p = primetab[fcode.e.c];
-        lookup:
-          hp = (hp + p) & HMASK;
-          i = htab[hp];
-          if (i == fc)
-            goto hfound;
-          if (i == -1)
-            goto out;
-          hp = (hp + p) & HMASK;
-          i = htab[hp];
-          if (i == fc)
-            goto hfound;
-          if (i == -1)
-            goto out;
-          hp = (hp + p) & HMASK;
-          i = htab[hp];
-          if (i == fc)
-            goto hfound;
-          if (i == -1)
-            goto out;
-          goto lookup;
-        }
-      out:;
-        output(outbuf, outbits, fcode.e.ent, n_bits);
+  private:
+  Stats *stats;
+  stats_clock::time_point start;
+};
 
-        {
-          long fc = fcode.code;
-          fcode.e.ent = fcode.e.c;
-          if (stcode)
-          {
-            codetab[hp] = (unsigned short)free_ent++;
-            htab[hp] = fc;
-          }
-        }
+/* Passes the output on, timing it if stats is set */
+class timed_sink : public Sink
+{
+  public:
+  timed_sink(Sink &out, Stats *stats)
+      : out(out)
+      , stats(stats)
+  {
+  }
 
-        goto next;
+  void write(const char *data, size_t size) override
+  {
+    io_timer timer(stats);
+    out.write(data, size);
+  }
 
-      endlop:
-        if (fcode.e.ent >= FIRST && rpos < rsize)
-          goto next2;
+  private:
+  Sink &out;
+  Stats *stats;
+};
 
-        if (rpos > rlop)
-        {
-          bytes_in += rpos - rlop;
-          rlop = rpos;
-        }
-      }
+/* Zeroes stats, if set, and sets its seconds to the time until it goes out of scope */
+class stats_scope
+{
+  public:
+  explicit stats_scope(Stats *stats)
+      : stats(stats)
+  {
+    if (stats)
+    {
+      *stats = Stats();
+      start = stats_clock::now();
     }
-    while (rlop < rsize);
   }
 
-  if (in.bad())
-    read_error();
-
-  if (bytes_in > 0)
-    output(outbuf, outbits, fcode.e.ent, n_bits);
-
-  out.write((char *)outbuf, (outbits + 7) >> 3);
-  if (out.fail())
-    write_error();
+  ~stats_scope()
+  {
+    if (stats)
+      stats->seconds = seconds_since(start);
+  }
 
-  bytes_out += (outbits + 7) >> 3;
-}
+  private:
+  Stats *stats;
+  stats_clock::time_point start;
+};
 
 /*
- * Decompress input stream to output stream. This routine adapts to the codes in the
- * file building the "string" table on-the-fly; requiring no table to
- * be stored in the compressed file.  The tables used herein are shared
- * with those of the compress() routine.  See the definitions above. */
-void
-decompress(std::istream &in, std::ostream &out)
+ * Compresses the input incrementally, block by block, into a sink. The output does not
+ * depend on how the input is split into blocks.
+ *
+ * Algorithm:  use open addressing double hashing (no chaining) on the
+ * prefix code / next character combination.  We do a variant of Knuth's
+ * algorithm D (vol. 3, sec. 6.4) along with G. Knott's relatively-prime
+ * secondary probe.  Here, the modular division first probe is gives way
+ * to a faster exclusive-or manipulation.  Also do block compression with
+ * an adaptive reset, whereby the code table is cleared when the compression
+ * ratio decreases, but after the table fills.  The variable-length output
+ * codes are re-sized at this point, and a special CLEAR code is generated
+ * for the decompressor.  Late addition:  construct the table according to
+ * file size for noticeable speed improvement on small files.  Please direct
+ * questions about this implementation to ames!jaw. */
+class encoder
 {
-  char_type inbuf[IBUFSIZ + 64]; /* Input buffer */
-  char_type outbuf[OBUFSIZ + 2048]; /* Output buffer */
+  public:
+  encoder();
+
+  /* Starts compressing a new stream into the sink. Can be called again after finish().
+   * size_hint is the expected input size, 0 if unknown. Without the header, the output
+   * can only be appended to that of finish_segment(). If stats is set, the counts of the
+   * stream are added to it on finish(). */
+  void start(Sink &out, const CompressOptions &options, size_t size_hint, Stats *stats,
+      bool header = true);
+  void write(const char_type *data, size_t size);
+  void finish();
+
+  /* Like finish(), but ends the output with a CLEAR code, so that the output of another
+   * encoder started without a header can follow it. */
+  void finish_segment();
+
+  private:
+  Sink *out = nullptr;
+  bool active = false; /* Between start() and a successful finish() */
+
+  /* Output buffer, passed on in chunks of outchunk bytes. The bytes past the output
+   * written so far are kept zero. */
+  std::unique_ptr<char_type[]> outbuf;
+  size_t alloc_outbuf = 0; /* Allocated size of outbuf */
+  int outchunk = 0;
+
+  /* The hash table is sized by hash_bits() and grown by grow_htab() if the input turns
+   * out to be larger than hinted. Only a prefix of it is in use for small inputs. The
+   * table is kept empty between streams and its allocation is never shrunk. */
+  std::unique_ptr<hslot_type[]> htab;
+  std::unique_ptr<int[]> code_slot; /* htab slot of each code, to clear used entries */
+  std::unique_ptr<unsigned[]> ovf_key; /* Keys of codes at the last probe number */
+  int alloc_hbits = 0; /* log2 of the allocated hash table size */
+  int alloc_bits = 0; /* maxbits code_slot and ovf_key have been allocated for */
+  int hbits = 0; /* log2 of the hash table size in use */
+  code_int grow_at = 0; /* free_ent at which the hash table is grown */
+
+  /* With Dictionary::direct, the code of each string (ent, c) is at child[ent << 8 | c],
+   * 0 if it is not in the table. code_slot is used to clear it like htab. */
+  std::unique_ptr<unsigned short[]> child;
+  int alloc_child_bits = 0; /* maxbits child has been allocated for */
+  Dictionary dictionary = Dictionary::hash;
+
+  /* The table of Dictionary::bucketed, sized by bucket_bits() and grown like htab. The
+   * buckets are aligned to 64 bytes within bucket_mem. code_slot holds the bucket of each
+   * code times BUCKET_SLOTS plus its slot. */
+  std::unique_ptr<char[]> bucket_mem;
+  bucket *btab = nullptr;
+  int alloc_bbits = 0; /* log2 of the allocated number of buckets */
+  int bbits = 0; /* log2 of the number of buckets in use */
 
-  long bytes_in = 0; /* Total number of bytes from input */
+  int maxbits = BITS; /* user settable max # bits/code */
 
-  count_int htab[HSIZE];
-  unsigned short codetab[HSIZE];
+  /* The ResetPolicy, with intervals of MAX_GAP for never */
+  long check_gap = 0;
+  long reset_gap = 0;
+  std::int64_t ratio_keep = 0; /* 1 - threshold, with 16 fractional bits */
 
-  auto tab_prefixof = [&codetab](code_int i) -> codetab_type & { return codetab[i]; };
-  auto tab_suffixof = [&htab](
-                          code_int i) -> char_type & { return ((char_type *)htab)[i]; };
-  auto de_stack = [&htab]() { return (char_type *)&(htab[HSIZE - 1]); };
-  auto clear_tab_prefixof = [&]() { memset(codetab, 0, 256); };
+  Stats *stats = nullptr;
+  Stats counts; /* Counts of the stream if stats is set, in part also if not */
 
-  int insize = 0;
-  int rsize;
-  while (insize < 3 && in.good())
+  /* Copied into local variables while compressing, so that it can be kept in registers */
+  struct
   {
-    in.read((char *)(inbuf + insize), IBUFSIZ);
-    rsize = (int)in.gcount();
-    insize += rsize;
-  }
-  if (insize < 3 || inbuf[0] != MAGIC_1 || inbuf[1] != MAGIC_2)
+    long bytes_in; /* Total number of bytes from input */
+    long bytes_out; /* Total number of bytes to output */
+    int n_bits;
+    int stcode;
+    code_int free_ent;
+    code_int extcode;
+    int ratio;
+    long checkpoint;
+    long reset_at; /* bytes_in at which the table is cleared regardless of the ratio */
+    hslot_type ent; /* Code of the current prefix string */
+    int outbits;
+    int boff;
+  } st;
+
+  void clear_htab(code_int free_ent);
+  void grow_htab(code_int free_ent);
+  void alloc_buckets(int new_bbits);
+  void grow_buckets(code_int free_ent);
+  void update_grow_at();
+  template <Dictionary Dict, class Scan, bool Collect>
+  void compress_block(const char_type *inbuf, int rsize);
+  template <Dictionary Dict, bool Collect>
+  void compress_default(const char_type *inbuf, int rsize);
+#if BUCKET_AVX2
+  template <bool Collect> void compress_avx2(const char_type *inbuf, int rsize);
+#endif
+  template <bool Collect> void select_compress();
+
+  /* Instance of compress_block() for the dictionary, the CPU and whether stats is set */
+  void (encoder::*compress_fn)(const char_type *inbuf, int rsize) = nullptr;
+  void report_counts();
+};
+
+encoder::encoder()
+{
+  st.free_ent = FIRST;
+}
+
+/* Converts an interval of a ResetPolicy, where 0 means never */
+long
+policy_gap(size_t interval)
+{
+  return interval ? (long)std::min<size_t>(interval, MAX_GAP) : MAX_GAP;
+}
+
+void
+encoder::start(Sink &out, const CompressOptions &options, size_t size_hint, Stats *stats,
+    bool header)
+{
+  if (options.max_bits < MIN_BITS || options.max_bits > MAX_BITS)
   {
-    if (in.bad())
-      read_error();
-    if (insize == 0)
-      throw std::invalid_argument("input stream is empty");
-    throw std::invalid_argument("not in LZW-compressed format");
+    throw std::invalid_argument("max_bits must be between " + std::to_string(MIN_BITS) +
+        " and " + std::to_string(MAX_BITS));
   }
-  bytes_in = insize;
-
-  const int maxbits = inbuf[2] & BIT_MASK;
-  const int block_mode = inbuf[2] & BLOCK_MODE;
-  if (maxbits > BITS)
+  check_buffer_size("write_size", options.write_size);
+  const ResetPolicy &policy = options.reset_policy;
+  if (!(policy.threshold >= 0 && policy.threshold < 1))
+    throw std::invalid_argument("reset_policy.threshold must be between 0 and 1");
+  if (options.dictionary == Dictionary::direct && options.max_bits > MAX_DIRECT_BITS)
   {
-    throw std::invalid_argument("compressed with " + std::to_string(maxbits) +
-        " bits, can only handle " + std::to_string(BITS) + " bits");
+    throw std::invalid_argument("max_bits must be at most " +
+        std::to_string(MAX_DIRECT_BITS) + " with Dictionary::direct");
   }
 
-  int n_bits;
-  int bitmask;
-  code_int maxcode;
-  const code_int maxmaxcode = MAXCODE(maxbits);
-  reset_n_bits_for_decompressor(n_bits, bitmask, maxbits, maxcode, maxmaxcode);
-
-  code_int oldcode = -1;
-  int finchar = 0;
-  int outpos = 0;
-  int posbits = 3 << 3;
-  code_int free_ent = block_mode ? FIRST : 256;
-
-  clear_tab_prefixof(); /* As above, initialize the first
-                           256 entries in the table. */
+  if (active)
+  { /* The previous stream was interrupted, its state is unknown */
+    if (htab)
+      memset(htab.get(), 0, sizeof(hslot_type) << alloc_hbits);
+    if (child)
+      memset(child.get(), 0, sizeof(unsigned short) << (alloc_child_bits + 8));
+    if (btab)
+      memset(btab, 0, sizeof(bucket) << alloc_bbits);
+    if (outbuf)
+      memset(outbuf.get(), 0, alloc_outbuf);
+  }
+  else if (htab || child || btab)
+    clear_htab(st.free_ent); /* With the dictionary of the previous stream */
 
-  for (code_int code = 255; code >= 0; --code)
-    tab_suffixof(code) = (char_type)code;
+  /* Room for the codes added to a full chunk before it is passed on */
+  outchunk = (int)options.write_size;
+  if (alloc_outbuf < (size_t)outchunk + 2048)
+  {
+    alloc_outbuf = (size_t)outchunk + 2048;
+    outbuf.reset(new char_type[alloc_outbuf]());
+  }
 
-  do
+  maxbits = options.max_bits;
+  dictionary = options.dictionary;
+  check_gap = policy_gap(policy.check_interval);
+  reset_gap = policy_gap(policy.reset_interval);
+  ratio_keep = (std::int64_t)((1 - policy.threshold) * 65536 + 0.5);
+  bbits = 0;
+  if (dictionary == Dictionary::direct)
   {
-  resetbuf:;
+    hbits = 0;
+    if (alloc_child_bits < maxbits)
     {
-      int o = posbits >> 3;
-      int e = (o <= insize) ? insize - o : 0;
-
-      for (int i = 0; i < e; ++i)
-        inbuf[i] = inbuf[i + o];
-
-      insize = e;
-      posbits = 0;
+      child.reset(new unsigned short[(size_t)1 << (maxbits + 8)]());
+      alloc_child_bits = maxbits;
     }
-
-    if (insize < (int)sizeof(inbuf) - IBUFSIZ)
-    {
-      in.read((char *)(inbuf + insize), IBUFSIZ);
-      if (in.bad())
-        read_error();
-      rsize = (int)in.gcount();
-      insize += rsize;
+  }
+  else if (dictionary == Dictionary::bucketed)
+  {
+    hbits = 0;
+    bbits = bucket_bits(maxbits, size_hint);
+    if (alloc_bbits < bbits)
+      alloc_buckets(bbits);
+  }
+  else
+  {
+    hbits = hash_bits(maxbits, size_hint);
+    if (alloc_hbits < hbits)
+    {
+      htab.reset(new hslot_type[(size_t)1 << hbits]());
+      alloc_hbits = hbits;
     }
+  }
+  if (alloc_bits < maxbits)
+  {
+    code_slot.reset(new int[(size_t)1 << maxbits]);
+    ovf_key.reset(new unsigned[(size_t)1 << maxbits]);
+    alloc_bits = maxbits;
+  }
+  update_grow_at();
+
+  this->out = &out;
+  this->stats = stats;
+  if (stats)
+    select_compress<true>();
+  else
+    select_compress<false>();
+  counts = Stats();
+  active = true;
+
+  st.bytes_in = 0;
+  st.bytes_out = 0;
+  reset_n_bits_for_compressor(st.n_bits, st.stcode, st.free_ent, st.extcode, maxbits);
+  st.ratio = 0;
+  st.checkpoint = check_gap;
+  st.reset_at = std::max(reset_gap, 2L); /* A stream cannot start with a CLEAR code */
+  st.ent = 0;
+
+  if (header)
+  {
+    outbuf[0] = MAGIC_1;
+    outbuf[1] = MAGIC_2;
+    outbuf[2] = (char_type)(maxbits | BLOCK_MODE);
+    st.outbits = 3 << 3;
+  }
+  else
+    st.outbits = 0;
+  st.boff = st.outbits;
+}
 
-    int inbits =
-        (rsize > 0) ? (insize - insize % n_bits) << 3 : (insize << 3) - (n_bits - 1);
-
-    while (inbits > posbits)
+/* Empties the hash table, which has had the codes FIRST..free_ent-1 added to it. */
+void
+encoder::clear_htab(code_int free_ent)
+{
+  if (dictionary == Dictionary::direct)
+  {
+    for (code_int code = FIRST; code < free_ent; ++code)
+      child[code_slot[code]] = 0;
+    return;
+  }
+  if (dictionary == Dictionary::bucketed)
+  {
+    if (free_ent - FIRST > ((long)BUCKET_SLOTS << bbits) / 16)
+      memset(btab, 0, sizeof(bucket) << bbits);
+    else
     {
-      if (free_ent > maxcode)
+      for (code_int code = FIRST; code < free_ent; ++code)
       {
-        posbits = (posbits - 1) +
-            ((n_bits << 3) - (posbits - 1 + (n_bits << 3)) % (n_bits << 3));
-
-        ++n_bits;
-        maxcode = (n_bits == maxbits) ? maxmaxcode : MAXCODE(n_bits) - 1;
-        bitmask = (1 << n_bits) - 1;
-        goto resetbuf;
+        int slot = code_slot[code];
+        btab[slot / BUCKET_SLOTS].key[slot % BUCKET_SLOTS] = 0;
       }
+    }
+    return;
+  }
+  code_int used = free_ent - FIRST;
+  if (used > (1L << hbits) / 16)
+    memset(htab.get(), 0, sizeof(hslot_type) << hbits);
+  else
+  {
+    for (code_int code = FIRST; code < free_ent; ++code)
+      htab[code_slot[code]] = 0;
+  }
+}
 
-      code_int code = input(inbuf, posbits, n_bits, bitmask);
+/* Moves the codes FIRST..free_ent-1 to a hash table four times as large. The key of an
+ * entry is recovered from its character and probe number, or from ovf_key. */
+void
+encoder::grow_htab(code_int free_ent)
+{
+  int new_hbits = std::min(hbits + 2, full_hash_bits(maxbits));
+  int new_alloc_hbits = std::max(new_hbits, alloc_hbits);
+  std::unique_ptr<hslot_type[]> new_htab(new hslot_type[(size_t)1 << new_alloc_hbits]());
 
-      if (oldcode == -1)
+  const int hshift = hbits - 8;
+  const long hmask = (1L << hbits) - 1;
+  const int new_hshift = new_hbits - 8;
+  const long new_hmask = (1L << new_hbits) - 1;
+
+  for (code_int code = FIRST; code < free_ent; ++code)
+  {
+    long hp = code_slot[code];
+    hslot_type c = (htab[hp] >> 16) & 0xff;
+    hslot_type probe = htab[hp] >> 24;
+    long p = primetab[c];
+    hslot_type ent;
+    if (probe == PROBE_MAX >> 24)
+      ent = ovf_key[code];
+    else
+      ent = (hslot_type)((hp - (long)(probe - 1) * p) & hmask) ^ (c << hshift);
+
+    hp = (long)((c << new_hshift) ^ ent);
+    hslot_type key = PROBE_ONE | (c << 16);
+    while (new_htab[hp] != 0)
+    {
+      hp = (hp + p) & new_hmask;
+      if (key < PROBE_MAX)
+        key += PROBE_ONE;
+    }
+    if (key >= PROBE_MAX)
+      ovf_key[code] = ent;
+    code_slot[code] = (int)hp;
+    new_htab[hp] = key | (hslot_type)code;
+  }
+
+  htab = std::move(new_htab);
+  alloc_hbits = new_alloc_hbits;
+  hbits = new_hbits;
+  update_grow_at();
+}
+
+/* Allocates 1 << new_bbits empty buckets as btab */
+void
+encoder::alloc_buckets(int new_bbits)
+{
+  bucket_mem.reset(new char[(sizeof(bucket) << new_bbits) + 63]());
+  btab = (bucket *)(((std::uintptr_t)bucket_mem.get() + 63) & ~(std::uintptr_t)63);
+  alloc_bbits = new_bbits;
+}
+
+/* Moves the codes FIRST..free_ent-1 to four times as many buckets */
+void
+encoder::grow_buckets(code_int free_ent)
+{
+  int new_bbits = std::min(bbits + 2, full_bucket_bits(maxbits));
+  std::unique_ptr<char[]> old_mem = std::move(bucket_mem);
+  const bucket *old_btab = btab;
+  alloc_buckets(std::max(new_bbits, alloc_bbits));
+
+  const long bmask = (1L << new_bbits) - 1;
+  for (code_int code = FIRST; code < free_ent; ++code)
+  {
+    int slot = code_slot[code];
+    std::uint32_t key = old_btab[slot / BUCKET_SLOTS].key[slot % BUCKET_SLOTS];
+    long bp = (long)((key * BUCKET_MULT) >> (32 - new_bbits));
+    int k; /* The key is not in the table yet, so this finds the first empty slot */
+    while ((k = scalar_scan::find(btab[bp], key)) >= 2 * BUCKET_SLOTS)
+      bp = (bp + 1) & bmask;
+    k -= BUCKET_SLOTS;
+    btab[bp].key[k] = key;
+    btab[bp].code[k] = (std::uint16_t)code;
+    code_slot[code] = (int)(bp * BUCKET_SLOTS + k);
+  }
+
+  bbits = new_bbits;
+  update_grow_at();
+}
+
+/* Grows the hash table when it becomes 25% full and the buckets when they become half
+ * full, unless they are already full-sized. The child table of Dictionary::direct is
+ * never grown. */
+void
+encoder::update_grow_at()
+{
+  if (dictionary == Dictionary::hash && hbits < full_hash_bits(maxbits))
+    grow_at = FIRST + (1L << (hbits - 2));
+  else if (dictionary == Dictionary::bucketed && bbits < full_bucket_bits(maxbits))
+    grow_at = FIRST + ((long)BUCKET_SLOTS << (bbits - 1));
+  else
+    grow_at = MAXCODE(MAX_BITS) + 1;
+}
+
+template <bool Collect>
+void
+encoder::select_compress()
+{
+  if (dictionary == Dictionary::direct)
+    compress_fn = &encoder::compress_default<Dictionary::direct, Collect>;
+  else if (dictionary == Dictionary::hash)
+    compress_fn = &encoder::compress_default<Dictionary::hash, Collect>;
+#if BUCKET_AVX2
+  else if (have_avx2())
+    compress_fn = &encoder::compress_avx2<Collect>;
+#endif
+  else
+    compress_fn = &encoder::compress_default<Dictionary::bucketed, Collect>;
+}
+
+void
+encoder::write(const char_type *data, size_t size)
+{
+  /* Keep the block positions within the range of an int */
+  const size_t max_block = 1 << 30;
+  while (size > 0)
+  {
+    int rsize = (int)std::min(size, max_block);
+    (this->*compress_fn)(data, rsize);
+    data += rsize;
+    size -= rsize;
+  }
+}
+
+/* Instances of compress_block(). It is inlined into them, so that the buckets are
+ * searched with the instruction set the function is compiled for. */
+template <Dictionary Dict, bool Collect>
+void
+encoder::compress_default(const char_type *inbuf, int rsize)
+{
+  compress_block<Dict, default_scan, Collect>(inbuf, rsize);
+}
+
+#if BUCKET_AVX2
+template <bool Collect>
+TARGET_AVX2 void
+encoder::compress_avx2(const char_type *inbuf, int rsize)
+{
+  compress_block<Dictionary::bucketed, avx2_scan, Collect>(inbuf, rsize);
+}
+#endif
+
+/* Compresses a block of input, looking strings up in the Dict table and searching its
+ * buckets with Scan. With Collect, the codes and probes are counted, where a probe is a
+ * hash table slot or a bucket. */
+template <Dictionary Dict, class Scan, bool Collect>
+ALWAYS_INLINE void
+encoder::compress_block(const char_type *inbuf, int rsize)
+{
+  long bytes_in = st.bytes_in;
+  long bytes_out = st.bytes_out;
+  int n_bits = st.n_bits;
+  int stcode = st.stcode;
+  code_int free_ent = st.free_ent;
+  code_int extcode = st.extcode;
+  int ratio = st.ratio;
+  long checkpoint = st.checkpoint;
+  long reset_at = st.reset_at;
+  hslot_type ent = st.ent;
+  int outbits = st.outbits;
+  int boff = st.boff;
+  char_type *const outbuf = this->outbuf.get();
+  const int outchunk = this->outchunk;
+  const int outlimit = outchunk + 2048 - 32; /* Bytes that codes can be written to */
+  std::uint64_t acc;
+  int accpos;
+  load_words(outbuf, acc, accpos, outbits);
+
+  hslot_type *htab = this->htab.get();
+  int *const code_slot = this->code_slot.get();
+  unsigned *const ovf_key = this->ovf_key.get();
+  unsigned short *const child = this->child.get();
+  bucket *btab = this->btab;
+  int bshift = 32 - bbits;
+  long bmask = (1L << bbits) - 1;
+  int hshift = hbits - 8;
+  long hmask = (1L << hbits) - 1;
+
+  size_t codes = 0;
+  size_t probes = 0;
+
+  int rpos = 0;
+  if (bytes_in == 0)
+  {
+    ent = inbuf[0];
+    rpos = 1;
+  }
+
+  int rlop = 0;
+
+  do
+  {
+    if (free_ent >= grow_at)
+    {
+      if (Dict == Dictionary::bucketed)
       {
-        if (code >= 256)
-        {
-          throw std::invalid_argument(
-              "corrupt input - oldcode: -1, code: " + std::to_string((int)(code)));
-        }
-        oldcode = code;
-        finchar = (int)(code);
-        outbuf[outpos++] = (char_type)(code);
-        continue;
+        grow_buckets(free_ent);
+        btab = this->btab;
+        bshift = 32 - bbits;
+        bmask = (1L << bbits) - 1;
       }
-
-      if (code == CLEAR && block_mode)
+      else
       {
-        clear_tab_prefixof();
-        free_ent = FIRST - 1;
-        posbits = (posbits - 1) +
-            ((n_bits << 3) - (posbits - 1 + (n_bits << 3)) % (n_bits << 3));
-        reset_n_bits_for_decompressor(n_bits, bitmask, maxbits, maxcode, maxmaxcode);
-        goto resetbuf;
+        grow_htab(free_ent);
+        htab = this->htab.get();
+        hshift = hbits - 8;
+        hmask = (1L << hbits) - 1;
       }
+    }
 
-      code_int incode = code;
-      char_type *stackp = de_stack();
+    if (free_ent >= extcode && ent < FIRST)
+    {
+      if (n_bits < maxbits)
+      {
+        outbits = (outbits - 1) +
+            ((n_bits << 3) - ((outbits - boff - 1 + (n_bits << 3)) % (n_bits << 3)));
+        boff = outbits;
+        spill_words(outbuf, acc, accpos, outbits);
+        ++n_bits;
+        ++counts.width_changes;
+        extcode = (n_bits < maxbits) ? MAXCODE(n_bits) + 1 : MAXCODE(n_bits);
+      }
+      else
+      {
+        extcode = MAXCODE(16) + outchunk;
+        stcode = 0;
+      }
+    }
 
-      if (code >= free_ent) /* Special case for KwKwK string. */
+    if (ent < FIRST && (bytes_in >= reset_at || (!stcode && bytes_in >= checkpoint)))
+    {
+      bool reset = bytes_in >= reset_at;
+      if (!reset)
       {
-        if (code > free_ent)
-        {
-          char_type *p;
+        long int rat;
 
-          posbits -= n_bits;
-          p = &inbuf[posbits >> 3];
-          if (p == inbuf)
-            p++;
+        checkpoint = bytes_in + check_gap;
 
-          char err[200];
-          snprintf(err, 200,
-              "corrupt input - insize: %d, posbits: %d, "
-              "inbuf: %02X %02X %02X %02X %02X (%d)",
-              insize, posbits, p[-1], p[0], p[1], p[2], p[3], (posbits & 07));
-          throw std::invalid_argument(err);
-        }
+        if (bytes_in > 0x007fffff)
+        { /* shift will overflow */
+          rat = (bytes_out + (outbits >> 3)) >> 8;
 
-        *--stackp = (char_type)finchar;
-        code = oldcode;
+          if (rat == 0) /* Don't divide by zero */
+            rat = 0x7fffffff;
+          else
+            rat = bytes_in / rat;
+        }
+        else
+          rat = (bytes_in << 8) / (bytes_out + (outbits >> 3)); /* 8 fractional bits */
+        if (rat >= ratio)
+          ratio = (int)rat;
+        else /* Dropped by more than the threshold */
+          reset = ((std::int64_t)rat << 16) < ratio * ratio_keep;
       }
+      else
+        checkpoint = bytes_in + check_gap;
 
-      while ((cmp_code_int)code >= (cmp_code_int)256)
-      { /* Generate output characters in reverse order */
-        *--stackp = tab_suffixof(code);
-        code = tab_prefixof(code);
+      if (reset)
+      {
+        ratio = 0;
+        reset_at = bytes_in + reset_gap;
+        clear_htab(free_ent);
+        output_word(outbuf, acc, accpos, outbits, CLEAR, n_bits);
+        outbits = (outbits - 1) +
+            ((n_bits << 3) - ((outbits - boff - 1 + (n_bits << 3)) % (n_bits << 3)));
+        boff = outbits;
+        spill_words(outbuf, acc, accpos, outbits);
+        reset_n_bits_for_compressor(n_bits, stcode, free_ent, extcode, maxbits);
+        ++counts.clears;
       }
+    }
 
-      finchar = tab_suffixof(code);
-      *--stackp = (char_type)(finchar);
+    if (outbits >= (outchunk << 3))
+    {
+      sync_words(outbuf, acc, accpos);
+      out->write((char *)outbuf, outchunk);
+
+      outbits -= (outchunk << 3);
+      boff = -(((outchunk << 3) - boff) % (n_bits << 3));
+      bytes_out += outchunk;
+
+      memmove(outbuf, outbuf + outchunk, (outbits >> 3) + 1);
+      memset(outbuf + (outbits >> 3) + 1, '\0', outchunk);
+      load_words(outbuf, acc, accpos, outbits);
+    }
 
-      /* And put them out in forward order */
+    {
+      int i = rsize - rlop;
+
+      if ((code_int)i > extcode - free_ent)
+        i = (int)(extcode - free_ent);
+      if (stcode && (code_int)i > grow_at - free_ent)
+        i = (int)(grow_at - free_ent);
+      if (i > ((outlimit << 3) - outbits) / n_bits)
+        i = ((outlimit << 3) - outbits) / n_bits;
+
+      if (!stcode && (long)i > checkpoint - bytes_in)
+        i = (int)(checkpoint - bytes_in);
+      if ((long)i > reset_at - bytes_in)
+        i = (int)(reset_at - bytes_in);
+
+      rlop += i;
+      bytes_in += i;
+    }
 
+    {
+      /* The first probe for the key (c, ent) is at (c << hshift) ^ ent, from which ent
+       * can be recovered given c. Since the probe sequence only depends on c, an entry
+       * matches the key iff its character and probe number match. */
+      long hp;
+      hslot_type c; /* Next character */
+      hslot_type key; /* Slot contents for the key at the current probe, minus the code */
+      hslot_type i; /* Slot being probed */
+
+      goto next;
+    hfound:
+      if (Collect)
+        probes += key >> 24;
+      ent = i & 0xffffU;
+    next:
+      if (rpos >= rlop)
+        goto endlop;
+    next2:
+      c = inbuf[rpos++];
+      if (Dict == Dictionary::direct)
+      {
+        hp = (long)((ent << 8) | c);
+        key = PROBE_ONE;
+        i = child[hp];
+        if (i != 0)
+          goto hfound;
+        goto out;
+      }
+      if (Dict == Dictionary::bucketed)
       {
-        int i = (int)(de_stack() - stackp);
-        if (outpos + i >= OBUFSIZ)
+        std::uint32_t bkey = (ent << 8 | c) | BUCKET_USED;
+        hp = (long)((bkey * BUCKET_MULT) >> bshift);
+        key = PROBE_ONE;
+        for (;;)
         {
-          do
+          int k = Scan::find(btab[hp], bkey);
+          if (k < BUCKET_SLOTS)
+          {
+            i = btab[hp].code[k];
+            goto hfound;
+          }
+          if (k < 2 * BUCKET_SLOTS)
           {
-            if (i > OBUFSIZ - outpos)
-              i = OBUFSIZ - outpos;
-
-            if (i > 0)
-            {
-              memcpy(outbuf + outpos, stackp, i);
-              outpos += i;
-            }
-
-            if (outpos >= OBUFSIZ)
-            {
-              out.write((char *)outbuf, outpos);
-              if (out.fail())
-                write_error();
-
-              outpos = 0;
-            }
-            stackp += i;
-            i = (int)(de_stack() - stackp);
+            hp = hp * BUCKET_SLOTS + k - BUCKET_SLOTS;
+            goto out;
           }
-          while (i > 0);
+          hp = (hp + 1) & bmask;
+          if (key < PROBE_MAX)
+            key += PROBE_ONE;
+        }
+      }
+      {
+        hp = (long)((c << hshift) ^ ent);
+        key = PROBE_ONE | (c << 16);
+
+        i = htab[hp];
+        if ((i ^ key) < 0x10000U)
+          goto hfound;
+        if (i == 0)
+          goto out;
+
+        long p = primetab[c];
+      lookup:
+        hp = (hp + p) & hmask;
+        key += PROBE_ONE;
+        i = htab[hp];
+        if ((i ^ key) < 0x10000U)
+          goto hfound;
+        if (i == 0)
+          goto out;
+        hp = (hp + p) & hmask;
+        key += PROBE_ONE;
+        i = htab[hp];
+        if ((i ^ key) < 0x10000U)
+          goto hfound;
+        if (i == 0)
+          goto out;
+        hp = (hp + p) & hmask;
+        key += PROBE_ONE;
+        i = htab[hp];
+        if ((i ^ key) < 0x10000U)
+          goto hfound;
+        if (i == 0)
+          goto out;
+        if (key < PROBE_FAST_END)
+          goto lookup;
+
+        /* Long probe sequences share the last probe number and compare the full key */
+        for (;;)
+        {
+          hp = (hp + p) & hmask;
+          if (key < PROBE_MAX)
+            key += PROBE_ONE;
+          else if (Collect) /* Not counted by the probe number */
+            ++probes;
+          i = htab[hp];
+          if ((i ^ key) < 0x10000U &&
+              (key < PROBE_MAX || ovf_key[i & 0xffffU] == ent))
+            goto hfound;
+          if (i == 0)
+            goto out;
+        }
+      }
+    out:
+      if (Collect)
+      {
+        probes += key >> 24;
+        ++codes;
+      }
+      output_word(outbuf, acc, accpos, outbits, ent, n_bits);
+
+      if (stcode)
+      {
+        code_slot[free_ent] = (int)hp;
+        if (Dict == Dictionary::direct)
+          child[hp] = (unsigned short)free_ent++;
+        else if (Dict == Dictionary::bucketed)
+        {
+          bucket &b = btab[hp / BUCKET_SLOTS];
+          b.key[hp % BUCKET_SLOTS] = (ent << 8 | c) | BUCKET_USED;
+          b.code[hp % BUCKET_SLOTS] = (std::uint16_t)free_ent++;
         }
         else
         {
-          memcpy(outbuf + outpos, stackp, i);
-          outpos += i;
+          if (key >= PROBE_MAX)
+            ovf_key[free_ent] = ent;
+          htab[hp] = key | (hslot_type)free_ent++;
         }
       }
+      ent = c;
+
+      goto next;
 
-      code = free_ent;
-      if (code < maxmaxcode) /* Generate the new entry. */
+    endlop:
+      if (ent >= FIRST && rpos < rsize)
+        goto next2;
+
+      if (rpos > rlop)
       {
-        tab_prefixof(code) = (unsigned short)oldcode;
-        tab_suffixof(code) = (char_type)finchar;
-        free_ent = code + 1;
+        bytes_in += rpos - rlop;
+        rlop = rpos;
       }
+    }
+  }
+  while (rlop < rsize);
+
+  sync_words(outbuf, acc, accpos);
+  st.bytes_in = bytes_in;
+  st.bytes_out = bytes_out;
+  st.n_bits = n_bits;
+  st.stcode = stcode;
+  st.free_ent = free_ent;
+  st.extcode = extcode;
+  st.ratio = ratio;
+  st.checkpoint = checkpoint;
+  st.reset_at = reset_at;
+  st.ent = ent;
+  st.outbits = outbits;
+  st.boff = boff;
+  counts.codes += codes;
+  counts.probes += probes;
+}
+
+/* Adds the counts of the finished stream to stats */
+void
+encoder::report_counts()
+{
+  counts.bytes_in = (size_t)st.bytes_in;
+  counts.bytes_out = (size_t)st.bytes_out;
+  if (stats)
+    add_counts(*stats, counts);
+}
+
+void
+encoder::finish()
+{
+  if (st.bytes_in > 0)
+  {
+    output(outbuf.get(), st.outbits, st.ent, st.n_bits);
+    ++counts.codes;
+  }
+
+  int size = (st.outbits + 7) >> 3;
+  out->write((char *)outbuf.get(), size);
 
-      oldcode = incode; /* Remember previous code. */
+  st.bytes_out += size;
+  memset(outbuf.get(), 0, size);
+  active = false;
+  report_counts();
+}
+
+void
+encoder::finish_segment()
+{
+  int n8 = st.n_bits << 3;
+  if (st.bytes_in > 0)
+  {
+    if (st.free_ent >= st.extcode && st.n_bits < maxbits)
+    { /* Widen the codes as compress_block() would have before the next code */
+      st.outbits = (st.outbits - 1) + (n8 - ((st.outbits - st.boff - 1 + n8) % n8));
+      st.boff = st.outbits;
+      ++st.n_bits;
+      ++counts.width_changes;
+      n8 = st.n_bits << 3;
+      st.extcode = (st.n_bits < maxbits) ? MAXCODE(st.n_bits) + 1 : MAXCODE(st.n_bits);
     }
+    output(outbuf.get(), st.outbits, st.ent, st.n_bits);
+    ++counts.codes;
 
-    bytes_in += rsize;
+    /* The decoder adds an entry for the last code, which can widen the CLEAR code */
+    if (st.stcode && st.free_ent + 1 >= st.extcode && st.n_bits < maxbits)
+    {
+      st.outbits = (st.outbits - 1) + (n8 - ((st.outbits - st.boff - 1 + n8) % n8));
+      st.boff = st.outbits;
+      ++st.n_bits;
+      ++counts.width_changes;
+      n8 = st.n_bits << 3;
+    }
+    output(outbuf.get(), st.outbits, CLEAR, st.n_bits);
+    st.outbits = (st.outbits - 1) + (n8 - ((st.outbits - st.boff - 1 + n8) % n8));
+    ++counts.clears;
   }
-  while (rsize > 0);
 
-  if (outpos > 0)
+  /* Padded to the end of the group, which is at a byte boundary */
+  int size = st.outbits >> 3;
+  out->write((char *)outbuf.get(), size);
+
+  st.bytes_out += size;
+  memset(outbuf.get(), 0, size);
+  active = false;
+  report_counts();
+}
+
+const size_t WINDOW = 1 << 18; /* Output kept by the decoder for back-references */
+const size_t MAX_STRING = 1 << BITS; /* Longer than the longest string of codes */
+
+/*
+ * Decompresses the input incrementally, block by block. This routine adapts to the codes
+ * in the file building the "string" table on-the-fly; requiring no table to be stored in
+ * the compressed file.
+ *
+ * The codes are stored in groups of n_bits bytes (8 codes each). Whenever the code width
+ * changes or the table is cleared, compress() pads the output to the end of the current
+ * group, so the rest of that group is skipped. Complete groups are decoded in place from
+ * the input blocks; only groups straddling two blocks are assembled in a small carry
+ * buffer.
+ *
+ * The string of every code has been output before: a new entry is the previous string
+ * followed by the first byte of the current one, which is where it starts in the output.
+ * The decoder remembers that position and the length of each code's string and copies
+ * the string from there, like an LZ77 back-reference, instead of following the prefix
+ * chain one byte at a time. When writing to a sink, the output is kept in a sliding
+ * window of at least WINDOW bytes and each code is pointed at its latest copy as it is
+ * used, so that frequently used strings stay in the window. Strings that have left it are
+ * generated from the prefix chain, straight into the output since their length is known.
+ */
+class decoder
+{
+  public:
+  /* Starts decompressing a new stream. Can be called again after finish(). The output is
+   * either buffered internally and passed on to a sink in chunks of at least write_size
+   * bytes or written directly into a caller-supplied buffer. If stats is set, the counts
+   * of the stream are added to it on finish(). */
+  void start(Sink &out, size_t write_size, Stats *stats);
+  void start(char_type *dst, size_t capacity, Stats *stats);
+
+  void write(const char_type *data, size_t size);
+  void finish();
+
+  /* Passes any buffered output on to the sink */
+  void flush();
+
+  /* Number of bytes written to the caller-supplied buffer */
+  size_t size() const { return outpos; }
+
+  private:
+  Sink *out = nullptr;
+  char_type *outbuf = nullptr;
+  size_t outsize = 0;
+  size_t outpos = 0;
+  size_t outbase = 0; /* Position of outbuf[0] in the output */
+  size_t outdone = 0; /* Bytes of outbuf passed on to the sink */
+
+  long bytes_in = 0; /* Total number of bytes from input */
+
+  Stats *stats = nullptr;
+  Stats counts; /* Counts of the stream if stats is set, in part also if not */
+
+  char_type header[3];
+  int header_size = 0;
+
+  int maxbits;
+  int block_mode;
+  code_int maxmaxcode;
+
+  /* Copied into local variables while decoding, so that it can be kept in registers */
+  struct
   {
-    out.write((char *)outbuf, outpos);
-    if (out.fail())
-      write_error();
+    int n_bits;
+    int bitmask;
+    code_int maxcode;
+    code_int oldcode;
+    size_t oldpos; /* Position of the string of oldcode in the output */
+    size_t oldlen; /* Length of the string of oldcode */
+    code_int free_ent;
+  } st;
+
+  char_type carry[BITS + 8]; /* Group straddling two input blocks */
+  int carry_size = 0;
+
+  codetab_type tab_prefix[1 << BITS];
+  char_type tab_suffix[1 << BITS];
+  unsigned short tab_len[1 << BITS]; /* String lengths minus one */
+  size_t tab_pos[1 << BITS]; /* Positions of the strings in the output */
+
+  /* Output buffer when writing to a sink */
+  std::unique_ptr<char_type[]> own_outbuf;
+  size_t alloc_own_outbuf = 0;
+
+  void read_header();
+  template <bool Collect>
+  size_t decode_block(const char_type *inbuf, size_t size, bool final);
+  size_t decode(const char_type *inbuf, size_t size, bool final)
+  {
+    return stats ? decode_block<true>(inbuf, size, final)
+                 : decode_block<false>(inbuf, size, final);
   }
+  void make_room(size_t &outpos);
+};
+
+void
+decoder::start(Sink &out, size_t write_size, Stats *stats)
+{
+  check_buffer_size("write_size", write_size);
+  size_t size = WINDOW + std::max(write_size, MAX_STRING) + MAX_STRING;
+  if (alloc_own_outbuf < size)
+  {
+    own_outbuf.reset(new char_type[size]);
+    alloc_own_outbuf = size;
+  }
+  start(own_outbuf.get(), size, stats);
+  this->out = &out;
+}
+
+void
+decoder::start(char_type *dst, size_t capacity, Stats *stats)
+{
+  out = nullptr;
+  this->stats = stats;
+  counts = Stats();
+  outbuf = dst;
+  outsize = capacity;
+  outpos = 0;
+  outbase = 0;
+  outdone = 0;
+  bytes_in = 0;
+  header_size = 0;
+  carry_size = 0;
+}
+
+void
+decoder::read_header()
+{
+  if (header[0] != MAGIC_1 || header[1] != MAGIC_2)
+    throw std::invalid_argument("not in LZW-compressed format");
+
+  maxbits = header[2] & BIT_MASK;
+  block_mode = header[2] & BLOCK_MODE;
+  if (maxbits > BITS)
+  {
+    throw std::invalid_argument("compressed with " + std::to_string(maxbits) +
+        " bits, can only handle " + std::to_string(BITS) + " bits");
+  }
+
+  maxmaxcode = MAXCODE(maxbits);
+  reset_n_bits_for_decompressor(st.n_bits, st.bitmask, maxbits, st.maxcode, maxmaxcode);
+  st.oldcode = -1;
+  st.oldpos = 0;
+  st.oldlen = 0;
+  st.free_ent = block_mode ? FIRST : 256;
+
+  for (code_int code = 255; code >= 0; --code)
+  {
+    tab_prefix[code] = 0;
+    tab_suffix[code] = (char_type)code;
+  }
+}
+
+void
+decoder::write(const char_type *data, size_t size)
+{
+  if (header_size < 3)
+  {
+    while (header_size < 3 && size > 0)
+    {
+      header[header_size++] = *data++;
+      --size;
+      ++bytes_in;
+    }
+    if (header_size < 3)
+      return;
+    read_header();
+  }
+
+  /* Complete a group straddling the previous block in the carry buffer */
+  while (carry_size > 0)
+  {
+    int k = carry_size;
+    int n = (int)std::min(size, (size_t)(st.n_bits + 1 - k));
+    memcpy(carry + k, data, n);
+    carry_size += n;
+    if (carry_size <= st.n_bits)
+      return;
+
+    int used = (int)decode(carry, carry_size, false);
+    if (used == 0)
+    { /* Code width changed at the start of the group */
+      data += n;
+      size -= n;
+      continue;
+    }
+    /* Hand back the bytes of this block that were not part of the group */
+    data += used - k;
+    size -= used - k;
+    carry_size = 0;
+  }
+
+  size_t used;
+  while ((used = decode(data, size, false)) > 0)
+  {
+    data += used;
+    size -= used;
+  }
+  carry_size = (int)size;
+  memcpy(carry, data, carry_size);
+}
+
+void
+decoder::finish()
+{
+  if (header_size < 3)
+  {
+    if (header_size == 0)
+      throw std::invalid_argument("input stream is empty");
+    throw std::invalid_argument("not in LZW-compressed format");
+  }
+
+  /* Decode any complete codes left in the final partial group */
+  if (carry_size > 0)
+    decode(carry, carry_size, true);
+  carry_size = 0;
+
+  flush();
+
+  counts.bytes_in = (size_t)bytes_in;
+  counts.bytes_out = outbase + outpos;
+  if (stats)
+    add_counts(*stats, counts);
+}
+
+void
+decoder::flush()
+{
+  if (out && outpos > outdone)
+  {
+    out->write((char *)outbuf + outdone, outpos - outdone);
+    outdone = outpos;
+  }
+}
+
+/*
+ * Decodes the complete groups at the start of inbuf and returns the number of bytes
+ * consumed. Since input() reads one byte past the end of a group, a group is only
+ * complete when it is followed by at least one more byte. In the final block the last
+ * group may be incomplete, in which case inbuf must have a byte of padding after it. At
+ * most 128 MB are decoded per call to keep the bit positions within the range of an
+ * int. With Collect, the codes are counted. */
+template <bool Collect>
+size_t
+decoder::decode_block(const char_type *inbuf, size_t size, bool final)
+{
+  int n_bits = st.n_bits;
+  int bitmask = st.bitmask;
+  code_int maxcode = st.maxcode;
+  code_int oldcode = st.oldcode;
+  size_t oldpos = st.oldpos;
+  size_t oldlen = st.oldlen;
+  code_int free_ent = st.free_ent;
+  size_t outpos = this->outpos;
+  const bool sliding = out != nullptr;
+
+  /* Bit positions are relative to inbuf, which starts at a group boundary */
+  const int limit = (int)std::min(size, (size_t)1 << 27) << 3;
+  const int wordlimit = limit - 56; /* Codes before it are read with input_word() */
+  int posbits = 0;
+  int gstart = 0; /* Start of the groups of the current code width */
+  size_t codes = 0;
+
+  for (;;)
+  {
+    int inbits;
+    if (final)
+      inbits = limit - (n_bits - 1);
+    else
+    { /* End of the last complete group, input() reads one byte past it */
+      int n8 = n_bits << 3;
+      inbits = (limit - 8 > gstart) ? gstart + (limit - 8 - gstart) / n8 * n8 : gstart;
+    }
+
+    while (inbits > posbits)
+    {
+      if (free_ent > maxcode)
+      {
+        posbits = gstart + (posbits - gstart - 1) +
+            ((n_bits << 3) - (posbits - gstart - 1 + (n_bits << 3)) % (n_bits << 3));
+        gstart = posbits;
+
+        ++n_bits;
+        ++counts.width_changes;
+        maxcode = (n_bits == maxbits) ? maxmaxcode : MAXCODE(n_bits) - 1;
+        bitmask = (1 << n_bits) - 1;
+        goto nextgroups;
+      }
+
+      code_int code = posbits < wordlimit ? input_word(inbuf, posbits, n_bits, bitmask)
+                                          : input(inbuf, posbits, n_bits, bitmask);
+      if (Collect)
+        ++codes;
+
+      if (oldcode == -1)
+      {
+        if (code >= 256)
+        {
+          throw std::invalid_argument(
+              "corrupt input - oldcode: -1, code: " + std::to_string((int)(code)));
+        }
+        if (outpos == outsize)
+          make_room(outpos);
+        oldcode = code;
+        oldpos = outbase + outpos;
+        oldlen = 1;
+        outbuf[outpos++] = (char_type)(code);
+        continue;
+      }
+
+      if (code == CLEAR && block_mode)
+      {
+        free_ent = FIRST - 1;
+        posbits = gstart + (posbits - gstart - 1) +
+            ((n_bits << 3) - (posbits - gstart - 1 + (n_bits << 3)) % (n_bits << 3));
+        gstart = posbits;
+        reset_n_bits_for_decompressor(n_bits, bitmask, maxbits, maxcode, maxmaxcode);
+        ++counts.clears;
+        if (Collect)
+          --codes;
+        goto nextgroups;
+      }
+
+      /* The string of the code and an earlier copy of it in the output. For the KwKwK
+       * case, that is the previous string followed by its own first byte. */
+      size_t len;
+      size_t src;
+      bool kwkwk = code >= free_ent;
+      if (kwkwk)
+      {
+        if (code > free_ent)
+        {
+          char err[200];
+          snprintf(err, 200,
+              "corrupt input - code: %d, free_ent: %d, offset: %ld, bit offset: %d",
+              (int)code, (int)free_ent, bytes_in + ((posbits - n_bits) >> 3),
+              ((posbits - n_bits) & 07));
+          throw std::invalid_argument(err);
+        }
+        len = oldlen + 1;
+        src = oldpos;
+      }
+      else if (code < 256)
+      {
+        len = 1;
+        src = 0;
+      }
+      else
+      {
+        len = (size_t)tab_len[code] + 1;
+        src = tab_pos[code];
+        if (sliding) /* Not worth the extra store when the whole output is kept */
+          tab_pos[code] = outbase + outpos;
+      }
+
+      if (len > outsize - outpos)
+        make_room(outpos);
+      char_type *dst = outbuf + outpos;
+      size_t pos = outbase + outpos;
+
+      if (code < 256 && !kwkwk)
+        dst[0] = (char_type)code;
+      else if (src >= outbase)
+      { /* Copy the earlier occurrence, which ends at or before dst */
+        const char_type *from = outbuf + (src - outbase);
+        size_t n = kwkwk ? len - 1 : len;
+        if (n <= 16 && sliding && outsize - outpos >= 16)
+        { /* Whole 16-byte copy through a register, possibly overlapping dst. Only done
+           * in the own buffer, as the bytes after the output of a caller's buffer must
+           * be left alone. */
+          char_type tmp[16];
+          memcpy(tmp, from, 16);
+          memcpy(dst, tmp, 16);
+        }
+        else if (n <= 16)
+          copy_short(dst, from, n);
+        else
+          memcpy(dst, from, n);
+        if (kwkwk)
+          dst[len - 1] = from[0];
+      }
+      else
+      { /* Generate the string from the prefix chain, backwards from its end */
+        char_type *p = dst + len;
+        code_int c = code;
+        if (kwkwk)
+        {
+          --p;
+          c = oldcode;
+        }
+        while ((cmp_code_int)c >= (cmp_code_int)256)
+        {
+          *--p = tab_suffix[c];
+          c = tab_prefix[c];
+        }
+        *--p = (char_type)c;
+        if (kwkwk)
+          dst[len - 1] = dst[0];
+      }
+
+      if (free_ent < maxmaxcode) /* Generate the new entry. */
+      {
+        tab_prefix[free_ent] = (unsigned short)oldcode;
+        tab_suffix[free_ent] = dst[0];
+        tab_len[free_ent] = (unsigned short)oldlen;
+        tab_pos[free_ent] = oldpos;
+        ++free_ent;
+      }
+
+      oldcode = code;
+      oldpos = pos;
+      oldlen = len;
+      outpos += len;
+    }
+    break;
+
+  nextgroups:;
+  }
+
+  size_t pos = final ? size : std::min((size_t)(posbits >> 3), size);
+  bytes_in += (long)pos;
+  st.n_bits = n_bits;
+  st.bitmask = bitmask;
+  st.maxcode = maxcode;
+  st.oldcode = oldcode;
+  st.oldpos = oldpos;
+  st.oldlen = oldlen;
+  st.free_ent = free_ent;
+  this->outpos = outpos;
+  counts.codes += codes;
+  return pos;
+}
+
+/*
+ * Makes room for the longest possible string after outpos. When writing to a sink, the
+ * buffered output is passed on and the last WINDOW bytes of it are kept at the start of
+ * the buffer for back-references.
+ */
+void
+decoder::make_room(size_t &outpos)
+{
+  if (!out)
+    throw std::length_error("output buffer is too small");
+  this->outpos = outpos;
+  flush();
+  size_t keep = std::min(outpos, WINDOW);
+  memmove(outbuf, outbuf + outpos - keep, keep);
+  outbase += outpos - keep;
+  outpos = outdone = keep;
+}
+
+/*
+ * Builds the Index of a compressed stream. Follows the codes like the decoder, but only
+ * keeps track of the string lengths. The input is scanned block by block the same way,
+ * with groups straddling two blocks assembled in a carry buffer. */
+class indexer
+{
+  public:
+  indexer();
+
+  void write(const char_type *data, size_t size);
+  Index finish();
+
+  private:
+  Index index;
+  size_t bytes_in = 0; /* Total number of bytes from input */
+  size_t outpos = 0; /* Total number of bytes decoded */
+  size_t clear_pos = 0; /* Input offset of the segment after the last CLEAR code */
+  bool cleared = false; /* No code has been read since the last CLEAR code */
+
+  char_type header[3];
+  int header_size = 0;
+
+  int maxbits;
+  int block_mode;
+  code_int maxmaxcode;
+  int n_bits;
+  int bitmask;
+  code_int maxcode;
+  code_int oldcode;
+  code_int free_ent;
+
+  char_type carry[BITS + 8]; /* Group straddling two input blocks */
+  int carry_size = 0;
+
+  std::unique_ptr<unsigned[]> length; /* Length of the string of each code */
+
+  void read_header();
+  size_t scan_block(const char_type *inbuf, size_t size, bool final);
+};
+
+indexer::indexer()
+    : length(new unsigned[1 << BITS])
+{
+  for (code_int code = 0; code < 256; ++code)
+    length[code] = 1;
+}
+
+void
+indexer::read_header()
+{
+  if (header[0] != MAGIC_1 || header[1] != MAGIC_2)
+    throw std::invalid_argument("not in LZW-compressed format");
+
+  maxbits = header[2] & BIT_MASK;
+  block_mode = header[2] & BLOCK_MODE;
+  if (maxbits > BITS)
+  {
+    throw std::invalid_argument("compressed with " + std::to_string(maxbits) +
+        " bits, can only handle " + std::to_string(BITS) + " bits");
+  }
+
+  maxmaxcode = MAXCODE(maxbits);
+  reset_n_bits_for_decompressor(n_bits, bitmask, maxbits, maxcode, maxmaxcode);
+  oldcode = -1;
+  free_ent = block_mode ? FIRST : 256;
+  index.entries.push_back({3, 0});
+}
+
+void
+indexer::write(const char_type *data, size_t size)
+{
+  if (header_size < 3)
+  {
+    while (header_size < 3 && size > 0)
+    {
+      header[header_size++] = *data++;
+      --size;
+      ++bytes_in;
+    }
+    if (header_size < 3)
+      return;
+    read_header();
+  }
+
+  /* Complete a group straddling the previous block in the carry buffer */
+  while (carry_size > 0)
+  {
+    int k = carry_size;
+    int n = (int)std::min(size, (size_t)(n_bits + 1 - k));
+    memcpy(carry + k, data, n);
+    carry_size += n;
+    if (carry_size <= n_bits)
+      return;
+
+    int used = (int)scan_block(carry, carry_size, false);
+    if (used == 0)
+    { /* Code width changed at the start of the group */
+      data += n;
+      size -= n;
+      continue;
+    }
+    data += used - k;
+    size -= used - k;
+    carry_size = 0;
+  }
+
+  size_t used = scan_block(data, size, false);
+  data += used;
+  size -= used;
+  carry_size = (int)size;
+  memcpy(carry, data, carry_size);
+}
+
+Index
+indexer::finish()
+{
+  if (header_size < 3)
+  {
+    if (header_size == 0)
+      throw std::invalid_argument("input stream is empty");
+    throw std::invalid_argument("not in LZW-compressed format");
+  }
+
+  if (carry_size > 0)
+    scan_block(carry, carry_size, true);
+  carry_size = 0;
+
+  index.compressed_size = bytes_in;
+  index.decompressed_size = outpos;
+  return std::move(index);
+}
+
+/*
+ * Scans the complete groups at the start of inbuf like decoder::decode_block() and
+ * returns the number of bytes consumed. Positions are 64-bit, so there is no limit on the
+ * block size. */
+size_t
+indexer::scan_block(const char_type *inbuf, size_t size, bool final)
+{
+  /* Bit positions are relative to inbuf, which starts at a group boundary */
+  const std::uint64_t limit = (std::uint64_t)size << 3;
+  std::uint64_t posbits = 0;
+  std::uint64_t gstart = 0; /* Start of the groups of the current code width */
+
+  for (;;)
+  {
+    std::uint64_t inbits;
+    if (final)
+      inbits = limit >= (std::uint64_t)n_bits ? limit - (n_bits - 1) : 0;
+    else
+    { /* End of the last complete group, the code is read with one byte past it */
+      std::uint64_t n8 = n_bits << 3;
+      inbits = (limit > gstart + 8) ? gstart + (limit - 8 - gstart) / n8 * n8 : gstart;
+    }
+
+    while (inbits > posbits)
+    {
+      if (free_ent > maxcode)
+      {
+        std::uint64_t n8 = n_bits << 3;
+        posbits = gstart + (posbits - gstart + n8 - 1) / n8 * n8;
+        gstart = posbits;
+
+        ++n_bits;
+        maxcode = (n_bits == maxbits) ? maxmaxcode : MAXCODE(n_bits) - 1;
+        bitmask = (1 << n_bits) - 1;
+        goto nextgroups;
+      }
+
+      const char_type *p = inbuf + (posbits >> 3);
+      code_int code =
+          (((long)p[0] | (long)p[1] << 8 | (long)p[2] << 16) >> (posbits & 7)) & bitmask;
+      posbits += n_bits;
+
+      if (oldcode == -1)
+      {
+        if (code >= 256)
+        {
+          throw std::invalid_argument(
+              "corrupt input - oldcode: -1, code: " + std::to_string((int)(code)));
+        }
+        oldcode = code;
+        ++outpos;
+        continue;
+      }
+
+      if (code == CLEAR && block_mode)
+      {
+        free_ent = FIRST - 1;
+        std::uint64_t n8 = n_bits << 3;
+        posbits = gstart + (posbits - gstart + n8 - 1) / n8 * n8;
+        gstart = posbits;
+        reset_n_bits_for_decompressor(n_bits, bitmask, maxbits, maxcode, maxmaxcode);
+        clear_pos = bytes_in + (size_t)(posbits >> 3);
+        cleared = true;
+        goto nextgroups;
+      }
+
+      if (code > free_ent)
+      {
+        throw std::invalid_argument("corrupt input - code: " +
+            std::to_string((int)code) + ", free_ent: " + std::to_string((int)free_ent));
+      }
+
+      if (cleared)
+      { /* The first code after a CLEAR code starts a new segment */
+        index.entries.push_back({clear_pos, outpos});
+        cleared = false;
+      }
+
+      unsigned new_length = length[oldcode] + 1;
+      outpos += code == free_ent ? new_length : length[code];
+      if (free_ent < maxmaxcode)
+        length[free_ent++] = new_length;
+      oldcode = code;
+    }
+    break;
+
+  nextgroups:;
+  }
+
+  size_t pos = final ? size : std::min((size_t)(posbits >> 3), size);
+  bytes_in += pos;
+  return pos;
+}
+
+} // namespace
+
+/* The encoder and decoder are allocated on first use and kept for later calls */
+struct Context::Impl
+{
+  std::unique_ptr<encoder> enc;
+  std::unique_ptr<decoder> dec;
+
+  static encoder &get_encoder(Context &ctx)
+  {
+    if (!ctx.impl->enc)
+      ctx.impl->enc.reset(new encoder());
+    return *ctx.impl->enc;
+  }
+
+  static decoder &get_decoder(Context &ctx)
+  {
+    if (!ctx.impl->dec)
+      ctx.impl->dec.reset(new decoder());
+    return *ctx.impl->dec;
+  }
+};
+
+Context::Context()
+    : impl(new Impl())
+{
+}
+
+Context::~Context() = default;
+
+namespace
+{
+
+/* Borrows the context cached for the current thread, or a new one if it is already in use
+ * by an outer call (e.g. from a sink). The context is returned to the cache afterwards.
+ */
+class pooled_context
+{
+  public:
+  pooled_context()
+      : ctx(std::move(cached()))
+  {
+    if (!ctx)
+      ctx.reset(new Context());
+  }
+
+  ~pooled_context() { cached() = std::move(ctx); }
+
+  Context &get() { return *ctx; }
+
+  private:
+  std::unique_ptr<Context> ctx;
+
+  static std::unique_ptr<Context> &cached()
+  {
+    static thread_local std::unique_ptr<Context> ctx;
+    return ctx;
+  }
+};
+
+/* Collects the output of a segment in memory */
+class string_sink : public Sink
+{
+  public:
+  void write(const char *data, size_t size) override { buf.append(data, size); }
+
+  std::string buf;
+};
+
+/* Number of threads for a threads option, where 0 means one per CPU core */
+int
+thread_count(int threads)
+{
+  if (threads < 0)
+    throw std::invalid_argument("threads must not be negative");
+  if (threads == 0)
+    return std::max(1, (int)std::thread::hardware_concurrency());
+  return threads;
+}
+
+/* Number of threads to use for the options, 0 if not compressing in segments. Any threads
+ * option other than 1 compresses in segments, even if it resolves to a single thread, so
+ * that the output does not depend on the number of CPU cores. */
+int
+compress_threads(const CompressOptions &options)
+{
+  if (options.threads == 1)
+    return 0;
+  if (options.segment_size == 0 && options.threads >= 0)
+    throw std::invalid_argument("segment_size must be positive");
+  return thread_count(options.threads);
+}
+
+/*
+ * Runs task(coder, sink, i, stats) for i = 0..n-1 on the given number of threads, each
+ * with its own Coder, and passes the output of the tasks on to out in order from the
+ * calling thread. Tasks run at most two per thread ahead of the sink, so no more than
+ * that many outputs plus the one being written are kept in memory at a time. The first
+ * exception thrown by a task or by the sink stops the remaining tasks and is rethrown. If
+ * stats is set, each thread passes its own Stats to the tasks, and adds it to stats at
+ * the end.
+ */
+template <class Coder, class Task>
+void
+run_in_order(size_t n, int threads, Sink &out, Stats *stats, Task task)
+{
+  const size_t window = 2 * (size_t)threads; /* Tasks run ahead of the sink */
+
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::vector<std::string> output(n);
+  std::vector<bool> done(n);
+  size_t next = 0; /* Next task to run */
+  size_t written = 0; /* Outputs passed on to the sink */
+  bool failed = false;
+  std::exception_ptr error;
+
+  auto work = [&] {
+    try
+    {
+      std::unique_ptr<Coder> coder(new Coder());
+      Stats counts;
+      for (;;)
+      {
+        size_t i;
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          cond.wait(
+              lock, [&] { return failed || next == n || next < written + window; });
+          if (failed || next == n)
+            break;
+          i = next++;
+        }
+        string_sink sink;
+        task(*coder, sink, i, stats ? &counts : nullptr);
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          output[i] = std::move(sink.buf);
+          done[i] = true;
+        }
+        cond.notify_all();
+      }
+      if (stats)
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        add_counts(*stats, counts);
+      }
+    }
+    catch (...)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!error)
+        error = std::current_exception();
+      failed = true;
+      cond.notify_all();
+    }
+  };
+
+  std::vector<std::thread> workers;
+  try
+  {
+    for (int t = 0; t < threads && (size_t)t < n; ++t)
+      workers.emplace_back(work);
+
+    for (size_t i = 0; i < n; ++i)
+    {
+      std::string data;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [&] { return failed || done[i]; });
+        if (failed)
+          break;
+        data.swap(output[i]);
+        written = i + 1;
+      }
+      cond.notify_all();
+      if (!data.empty())
+        out.write(data.data(), data.size());
+    }
+  }
+  catch (...)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      failed = true;
+    }
+    cond.notify_all();
+    for (std::thread &worker : workers)
+      worker.join();
+    throw;
+  }
+
+  for (std::thread &worker : workers)
+    worker.join();
+  if (error)
+    std::rethrow_exception(error);
+}
+
+/*
+ * Compresses the input as independent segments of options.segment_size bytes on multiple
+ * threads. Each segment is started with an empty table and all but the last one end with
+ * a CLEAR code, after which the decoder starts over with an empty table as well, so the
+ * joined output is a single standard stream. first and last tell whether the input is at
+ * the start and at the end of the stream.
+ */
+void
+compress_segments(Context &ctx, const char_type *src, size_t size, Sink &out,
+    const CompressOptions &options, int threads, bool first, bool last)
+{
+  const size_t segment_size = options.segment_size;
+  const size_t n_segments = std::max<size_t>((size + segment_size - 1) / segment_size, 1);
+
+  auto compress_segment = [&](encoder &enc, Sink &sink, size_t i, Stats *stats) {
+    size_t pos = i * segment_size;
+    size_t n = std::min(segment_size, size - pos);
+    enc.start(sink, options, std::max<size_t>(n, 1), stats, first && i == 0);
+    enc.write(src + pos, n);
+    if (last && i == n_segments - 1)
+      enc.finish();
+    else
+      enc.finish_segment();
+  };
+
+  if (n_segments == 1)
+    compress_segment(Context::Impl::get_encoder(ctx), out, 0, options.stats);
+  else
+    run_in_order<encoder>(n_segments, threads, out, options.stats, compress_segment);
+}
+
+/* Discards the output */
+class null_sink : public Sink
+{
+  public:
+  void write(const char *, size_t) override {}
+};
+
+/* Passes the output on and builds its index on the way */
+class index_sink : public Sink
+{
+  public:
+  explicit index_sink(Sink &out)
+      : out(out)
+  {
+  }
+
+  void write(const char *data, size_t size) override
+  {
+    out.write(data, size);
+    ix.write((const char_type *)data, size);
+  }
+
+  Index finish() { return ix.finish(); }
+
+  private:
+  Sink &out;
+  indexer ix;
+};
+
+/* Passes on length bytes of the output after skipping the first skip bytes */
+class range_sink : public Sink
+{
+  public:
+  range_sink(Sink &out, size_t skip, size_t length)
+      : out(out)
+      , skip(skip)
+      , remaining(length)
+  {
+  }
+
+  void write(const char *data, size_t size) override
+  {
+    if (skip >= size)
+    {
+      skip -= size;
+      return;
+    }
+    size_t n = std::min(size - skip, remaining);
+    out.write(data + skip, n);
+    skip = 0;
+    remaining -= n;
+  }
+
+  /* Number of bytes still missing from the range */
+  size_t missing() const { return remaining; }
+
+  private:
+  Sink &out;
+  size_t skip;
+  size_t remaining;
+};
+
+/* Writes the output into a block of memory, throws std::length_error if it is full */
+class memory_sink : public Sink
+{
+  public:
+  memory_sink(char *dst, size_t capacity)
+      : dst(dst)
+      , capacity(capacity)
+  {
+  }
+
+  void write(const char *data, size_t size) override
+  {
+    if (size > capacity - pos)
+      throw std::length_error("output buffer is too small");
+    memcpy(dst + pos, data, size);
+    pos += size;
+  }
+
+  size_t size() const { return pos; }
+
+  private:
+  char *dst;
+  size_t capacity;
+  size_t pos = 0;
+};
+
+/* Checks that the index is consistent and belongs to an input of the given size */
+void
+check_index(const Index &index, size_t size)
+{
+  const std::vector<Index::Entry> &entries = index.entries;
+  if (size < 3 || index.compressed_size != size || entries.empty() ||
+      entries[0].in_offset != 3 || entries[0].out_offset != 0)
+    throw std::invalid_argument("index does not match the input");
+  for (size_t i = 1; i < entries.size(); ++i)
+  {
+    if (entries[i].in_offset <= entries[i - 1].in_offset || entries[i].in_offset > size ||
+        entries[i].out_offset < entries[i - 1].out_offset ||
+        entries[i].out_offset > index.decompressed_size)
+      throw std::invalid_argument("index does not match the input");
+  }
+}
+
+const char index_signature[4] = {'L', 'Z', 'W', 'I'};
+const int index_version = 1;
+const size_t index_header_size = 32;
+
+void
+put_u64(char *p, std::uint64_t value)
+{
+  for (int i = 0; i < 8; ++i)
+    p[i] = (char)(value >> (8 * i));
+}
+
+std::uint64_t
+get_u64(const char_type *p)
+{
+  std::uint64_t value = 0;
+  for (int i = 0; i < 8; ++i)
+    value |= (std::uint64_t)p[i] << (8 * i);
+  return value;
+}
+
+/*
+ * Decompresses the input on multiple threads, either into dst or, if dst is null, into
+ * out. The segments of the index are divided into about four runs per thread, each of
+ * which is decoded as a stream of its own: a segment after a CLEAR code decodes the same
+ * way as the start of a stream.
+ */
+size_t
+decompress_segments(const char_type *src, size_t size, const DecompressOptions &options,
+    int threads, char_type *dst, size_t capacity, Sink *out)
+{
+  Index built;
+  const Index &index = options.index ? *options.index : (built = build_index(src, size));
+  check_index(index, size);
+  const std::vector<Index::Entry> &entries = index.entries;
+  if (dst && index.decompressed_size > capacity)
+    throw std::length_error("output buffer is too small");
+
+  /* Runs of segments with roughly equal output sizes */
+  std::vector<size_t> runs;
+  const size_t run_size = index.decompressed_size / (4 * (size_t)threads) + 1;
+  for (size_t i = 0; i < entries.size(); ++i)
+  {
+    if (runs.empty() ||
+        entries[i].out_offset - entries[runs.back()].out_offset >= run_size)
+      runs.push_back(i);
+  }
+  runs.push_back(entries.size());
+
+  auto decompress_run = [&](decoder &dec, string_sink &sink, size_t r, Stats *stats) {
+    const Index::Entry &begin = entries[runs[r]];
+    size_t in_end = runs[r + 1] < entries.size() ? entries[runs[r + 1]].in_offset : size;
+    size_t out_end = runs[r + 1] < entries.size() ? entries[runs[r + 1]].out_offset
+                                                  : index.decompressed_size;
+    size_t out_size = out_end - begin.out_offset;
+
+    char_type *run_dst = dst + begin.out_offset;
+    if (!dst)
+    {
+      sink.buf.resize(out_size);
+      run_dst = (char_type *)&sink.buf[0];
+    }
+    try
+    {
+      dec.start(run_dst, out_size, stats);
+      dec.write(src, 3);
+      dec.write(src + begin.in_offset, in_end - begin.in_offset);
+      dec.finish();
+    }
+    catch (std::length_error &)
+    {
+      throw std::invalid_argument("index does not match the input");
+    }
+    if (dec.size() != out_size)
+      throw std::invalid_argument("index does not match the input");
+  };
+
+  null_sink discard;
+  run_in_order<decoder>(
+      runs.size() - 1, threads, dst ? discard : *out, options.stats, decompress_run);
+  if (options.stats) /* Every run has read the header */
+    options.stats->bytes_in = size;
+  return index.decompressed_size;
+}
+
+/* Passes the output on and counts its bytes */
+class counting_sink : public Sink
+{
+  public:
+  explicit counting_sink(Sink &out)
+      : out(out)
+  {
+  }
+
+  void write(const char *data, size_t size) override
+  {
+    out.write(data, size);
+    count += size;
+  }
+
+  size_t count = 0;
+
+  private:
+  Sink &out;
+};
+
+/*
+ * Runs task(coder, sink, i, stats) for each of the inputs of compress_many() or
+ * decompress_many() and returns the offsets of their outputs. With multiple threads, the
+ * inputs are divided into about four runs of equal total size per thread, which are
+ * processed by run_in_order().
+ */
+template <class Coder, class Task>
+std::vector<size_t>
+process_many(Coder &coder, const Buffer *inputs, size_t count, Sink &out, int threads,
+    Stats *stats, Task task)
+{
+  std::vector<size_t> offsets(count + 1);
+  if (threads == 1 || count <= 1)
+  {
+    counting_sink sink(out);
+    for (size_t i = 0; i < count; ++i)
+    {
+      task(coder, sink, i, stats);
+      offsets[i + 1] = sink.count;
+    }
+    return offsets;
+  }
+
+  /* Empty inputs still have a header and a setup cost, count them as one byte */
+  size_t total = 0;
+  for (size_t i = 0; i < count; ++i)
+    total += inputs[i].size + 1;
+  const size_t run_size = total / (4 * (size_t)threads) + 1;
+  std::vector<size_t> runs;
+  size_t run_total = 0;
+  for (size_t i = 0; i < count; ++i)
+  {
+    if (runs.empty() || run_total >= run_size)
+    {
+      runs.push_back(i);
+      run_total = 0;
+    }
+    run_total += inputs[i].size + 1;
+  }
+  runs.push_back(count);
+
+  /* Each run records the output sizes of its inputs, summed up at the end */
+  auto process_run = [&](Coder &run_coder, string_sink &sink, size_t r, Stats *counts) {
+    for (size_t i = runs[r]; i < runs[r + 1]; ++i)
+    {
+      size_t start = sink.buf.size();
+      task(run_coder, sink, i, counts);
+      offsets[i + 1] = sink.buf.size() - start;
+    }
+  };
+  run_in_order<Coder>(runs.size() - 1, threads, out, stats, process_run);
+  for (size_t i = 0; i < count; ++i)
+    offsets[i + 1] += offsets[i];
+  return offsets;
+}
+
+} // namespace
+
+void
+compress(Context &ctx, std::istream &in, Sink &out, const CompressOptions &options)
+{
+  if (options.index)
+  {
+    index_sink sink(out);
+    CompressOptions unindexed = options;
+    unindexed.index = nullptr;
+    compress(ctx, in, sink, unindexed);
+    *options.index = sink.finish();
+    return;
+  }
+
+  int threads = compress_threads(options);
+  stats_scope scope(options.stats);
+  timed_sink sink(out, options.stats);
+  if (threads > 0)
+  { /* Read and compress one segment per thread at a time */
+    const size_t max_batch = (size_t)std::numeric_limits<std::streamsize>::max();
+    if (options.segment_size > max_batch / (size_t)threads)
+      throw std::invalid_argument("segment_size is too large for the number of threads");
+    const size_t batch_size = options.segment_size * threads;
+    std::vector<char_type> batch; /* Grown as far as the input goes */
+    bool first = true;
+    for (;;)
+    {
+      size_t size = 0;
+      bool last;
+      {
+        io_timer timer(options.stats);
+        while (size < batch_size && in.good())
+        {
+          if (size == batch.size())
+            batch.resize(std::min(batch_size, std::max<size_t>(2 * size, 1 << 20)));
+          in.read((char *)batch.data() + size, (std::streamsize)(batch.size() - size));
+          size += (size_t)in.gcount();
+        }
+        last = !in.good() || in.peek() == std::istream::traits_type::eof();
+      }
+      if (in.bad())
+        read_error();
+      compress_segments(ctx, batch.data(), size, sink, options, threads, first, last);
+      if (last)
+        return;
+      first = false;
+    }
+  }
+
+  check_buffer_size("read_size", options.read_size);
+  std::unique_ptr<char_type[]> inbuf(new char_type[options.read_size]);
+  encoder &enc = Context::Impl::get_encoder(ctx);
+  enc.start(sink, options, options.size_hint, options.stats);
+
+  while (in.good())
+  {
+    std::streamsize rsize;
+    {
+      io_timer timer(options.stats);
+      in.read((char *)inbuf.get(), (std::streamsize)options.read_size);
+      rsize = in.gcount();
+    }
+    if (rsize <= 0)
+      break;
+    enc.write(inbuf.get(), (size_t)rsize);
+  }
+
+  if (in.bad())
+    read_error();
+
+  enc.finish();
+}
+
+void
+compress(std::istream &in, Sink &out, const CompressOptions &options)
+{
+  pooled_context ctx;
+  compress(ctx.get(), in, out, options);
+}
+
+void
+compress(std::istream &in, std::ostream &out, const CompressOptions &options)
+{
+  ostream_sink sink(out);
+  compress(in, sink, options);
+}
+
+void
+compress(
+    Context &ctx, const void *src, size_t size, Sink &out, const CompressOptions &options)
+{
+  if (options.index)
+  {
+    index_sink sink(out);
+    CompressOptions unindexed = options;
+    unindexed.index = nullptr;
+    compress(ctx, src, size, sink, unindexed);
+    *options.index = sink.finish();
+    return;
+  }
+
+  int threads = compress_threads(options);
+  stats_scope scope(options.stats);
+  timed_sink sink(out, options.stats);
+  if (threads > 0)
+  {
+    compress_segments(
+        ctx, (const char_type *)src, size, sink, options, threads, true, true);
+    return;
+  }
+
+  encoder &enc = Context::Impl::get_encoder(ctx);
+  enc.start(sink, options, std::max<size_t>(size, 1), options.stats);
+  enc.write((const char_type *)src, size);
+  enc.finish();
+}
+
+void
+compress(const void *src, size_t size, Sink &out, const CompressOptions &options)
+{
+  pooled_context ctx;
+  compress(ctx.get(), src, size, out, options);
+}
+
+void
+compress(const void *src, size_t size, std::ostream &out, const CompressOptions &options)
+{
+  ostream_sink sink(out);
+  compress(src, size, sink, options);
+}
+
+size_t
+compress(Context &ctx, const void *src, size_t size, void *dst, size_t capacity,
+    const CompressOptions &options)
+{
+  memory_sink sink((char *)dst, capacity);
+  compress(ctx, src, size, sink, options);
+  return sink.size();
+}
+
+size_t
+compress(const void *src, size_t size, void *dst, size_t capacity,
+    const CompressOptions &options)
+{
+  pooled_context ctx;
+  return compress(ctx.get(), src, size, dst, capacity, options);
+}
+
+size_t
+compress_bound(size_t size, const CompressOptions &options)
+{
+  const int maxbits = options.max_bits;
+  if (maxbits < MIN_BITS || maxbits > MAX_BITS)
+  {
+    throw std::invalid_argument("max_bits must be between " + std::to_string(MIN_BITS) +
+        " and " + std::to_string(MAX_BITS));
+  }
+
+  /* A table is started at the beginning, after every CLEAR code, which needs a full
+   * table, i.e. at least one input byte per entry, or reset_interval bytes, and after
+   * every segment */
+  size_t tables = 1 + size / (size_t)(MAXCODE(maxbits) - FIRST);
+  if (options.reset_policy.reset_interval > 0)
+    tables += size / options.reset_policy.reset_interval;
+  if (options.threads != 1)
+  {
+    if (options.segment_size == 0)
+      throw std::invalid_argument("segment_size must be positive");
+    tables += size / options.segment_size + 1;
+  }
+
+  /* Each table has up to maxbits - INIT_BITS width changes, two more at the end of a
+   * segment, and a CLEAR code and the last code of a segment besides the input codes.
+   * Every padding is shorter than a group of maxbits bytes. */
+  size_t per_table = (size_t)(maxbits - INIT_BITS + 3) * maxbits + 4;
+  return 3 + size / 8 * maxbits + ((size % 8) * maxbits + 7) / 8 + tables * per_table + 1;
+}
+
+void
+decompress(Context &ctx, std::istream &in, Sink &out, const DecompressOptions &options)
+{
+  check_buffer_size("read_size", options.read_size);
+  std::unique_ptr<char_type[]> inbuf(new char_type[options.read_size]);
+  stats_scope scope(options.stats);
+  timed_sink sink(out, options.stats);
+  decoder &dec = Context::Impl::get_decoder(ctx);
+  dec.start(sink, options.write_size, options.stats);
+
+  while (in.good())
+  {
+    std::streamsize rsize;
+    {
+      io_timer timer(options.stats);
+      in.read((char *)inbuf.get(), (std::streamsize)options.read_size);
+      rsize = in.gcount();
+    }
+    if (rsize <= 0)
+      break;
+    dec.write(inbuf.get(), (size_t)rsize);
+  }
+
+  if (in.bad())
+    read_error();
+
+  dec.finish();
+}
+
+void
+decompress(std::istream &in, Sink &out, const DecompressOptions &options)
+{
+  pooled_context ctx;
+  decompress(ctx.get(), in, out, options);
+}
+
+void
+decompress(std::istream &in, std::ostream &out, const DecompressOptions &options)
+{
+  ostream_sink sink(out);
+  decompress(in, sink, options);
+}
+
+void
+decompress(Context &ctx, const void *src, size_t size, Sink &out,
+    const DecompressOptions &options)
+{
+  int threads = thread_count(options.threads);
+  stats_scope scope(options.stats);
+  timed_sink sink(out, options.stats);
+  if (threads > 1)
+  {
+    decompress_segments(
+        (const char_type *)src, size, options, threads, nullptr, 0, &sink);
+    return;
+  }
+
+  decoder &dec = Context::Impl::get_decoder(ctx);
+  dec.start(sink, options.write_size, options.stats);
+  dec.write((const char_type *)src, size);
+  dec.finish();
+}
+
+void
+decompress(const void *src, size_t size, Sink &out, const DecompressOptions &options)
+{
+  pooled_context ctx;
+  decompress(ctx.get(), src, size, out, options);
+}
+
+void
+decompress(
+    const void *src, size_t size, std::ostream &out, const DecompressOptions &options)
+{
+  ostream_sink sink(out);
+  decompress(src, size, sink, options);
+}
+
+size_t
+decompress(Context &ctx, const void *src, size_t size, void *dst, size_t capacity,
+    const DecompressOptions &options)
+{
+  int threads = thread_count(options.threads);
+  stats_scope scope(options.stats);
+  if (threads > 1)
+  {
+    return decompress_segments((const char_type *)src, size, options, threads,
+        (char_type *)dst, capacity, nullptr);
+  }
+
+  decoder &dec = Context::Impl::get_decoder(ctx);
+  dec.start((char_type *)dst, capacity, options.stats);
+  dec.write((const char_type *)src, size);
+  dec.finish();
+  return dec.size();
+}
+
+size_t
+decompress(const void *src, size_t size, void *dst, size_t capacity,
+    const DecompressOptions &options)
+{
+  pooled_context ctx;
+  return decompress(ctx.get(), src, size, dst, capacity, options);
+}
+
+std::vector<size_t>
+compress_many(Context &ctx, const Buffer *inputs, size_t count, Sink &out,
+    const CompressOptions &options)
+{
+  int threads = thread_count(options.threads);
+  stats_scope scope(options.stats);
+  timed_sink timed(out, options.stats);
+  return process_many(Context::Impl::get_encoder(ctx), inputs, count, timed, threads,
+      options.stats, [&](encoder &enc, Sink &sink, size_t i, Stats *stats) {
+        enc.start(sink, options, std::max<size_t>(inputs[i].size, 1), stats);
+        enc.write((const char_type *)inputs[i].data, inputs[i].size);
+        enc.finish();
+      });
+}
+
+std::vector<size_t>
+compress_many(
+    const Buffer *inputs, size_t count, Sink &out, const CompressOptions &options)
+{
+  pooled_context ctx;
+  return compress_many(ctx.get(), inputs, count, out, options);
+}
+
+std::vector<size_t>
+decompress_many(Context &ctx, const Buffer *inputs, size_t count, Sink &out,
+    const DecompressOptions &options)
+{
+  int threads = thread_count(options.threads);
+  check_buffer_size("write_size", options.write_size);
+  stats_scope scope(options.stats);
+  timed_sink timed(out, options.stats);
+  return process_many(Context::Impl::get_decoder(ctx), inputs, count, timed, threads,
+      options.stats, [&](decoder &dec, Sink &sink, size_t i, Stats *stats) {
+        try
+        {
+          dec.start(sink, options.write_size, stats);
+          dec.write((const char_type *)inputs[i].data, inputs[i].size);
+          dec.finish();
+        }
+        catch (std::invalid_argument &e)
+        {
+          throw std::invalid_argument("input " + std::to_string(i) + ": " + e.what());
+        }
+      });
+}
+
+std::vector<size_t>
+decompress_many(
+    const Buffer *inputs, size_t count, Sink &out, const DecompressOptions &options)
+{
+  pooled_context ctx;
+  return decompress_many(ctx.get(), inputs, count, out, options);
+}
+
+Index
+build_index(const void *src, size_t size)
+{
+  indexer ix;
+  ix.write((const char_type *)src, size);
+  return ix.finish();
+}
+
+void
+write_index(const Index &index, Sink &out)
+{
+  char header[index_header_size] = {};
+  memcpy(header, index_signature, 4);
+  header[4] = (char)index_version;
+  put_u64(header + 8, index.compressed_size);
+  put_u64(header + 16, index.decompressed_size);
+  put_u64(header + 24, index.entries.size());
+  out.write(header, sizeof(header));
+
+  char buf[4096];
+  size_t n = 0;
+  for (const Index::Entry &entry : index.entries)
+  {
+    put_u64(buf + n, entry.in_offset);
+    put_u64(buf + n + 8, entry.out_offset);
+    n += 16;
+    if (n == sizeof(buf))
+    {
+      out.write(buf, n);
+      n = 0;
+    }
+  }
+  if (n > 0)
+    out.write(buf, n);
+}
+
+void
+write_index(const Index &index, std::ostream &out)
+{
+  ostream_sink sink(out);
+  write_index(index, sink);
+}
+
+Index
+read_index(const void *data, size_t size)
+{
+  const char_type *p = (const char_type *)data;
+  if (size < index_header_size || memcmp(p, index_signature, 4) != 0)
+    throw std::invalid_argument("not an LZW index");
+  if (p[4] != index_version)
+    throw std::invalid_argument("unsupported LZW index version " + std::to_string(p[4]));
+
+  Index index;
+  index.compressed_size = (size_t)get_u64(p + 8);
+  index.decompressed_size = (size_t)get_u64(p + 16);
+  std::uint64_t n = get_u64(p + 24);
+  if (n != (size - index_header_size) / 16 || (size - index_header_size) % 16 != 0)
+    throw std::invalid_argument("LZW index is truncated");
+
+  index.entries.resize((size_t)n);
+  p += index_header_size;
+  for (Index::Entry &entry : index.entries)
+  {
+    entry.in_offset = (size_t)get_u64(p);
+    entry.out_offset = (size_t)get_u64(p + 8);
+    p += 16;
+  }
+  return index;
+}
+
+void
+decompress_range(Context &ctx, const void *src, size_t size, const Index &index,
+    size_t offset, size_t length, Sink &out)
+{
+  /* Only the entries in use are checked, so the cost does not grow with the index size */
+  const std::vector<Index::Entry> &entries = index.entries;
+  if (size < 3 || index.compressed_size != size || entries.empty() ||
+      entries[0].out_offset != 0)
+    throw std::invalid_argument("index does not match the input");
+  if (offset >= index.decompressed_size)
+    return;
+  length = std::min(length, index.decompressed_size - offset);
+  if (length == 0)
+    return;
+
+  /* From the last segment starting at or before the offset to the first one starting at
+   * or after the end of the range */
+  auto first = std::upper_bound(entries.begin(), entries.end(), offset,
+                   [](size_t pos, const Index::Entry &e) { return pos < e.out_offset; }) -
+      1;
+  auto last = std::lower_bound(first, entries.end(), offset + length,
+      [](const Index::Entry &e, size_t pos) { return e.out_offset < pos; });
+  size_t in_end = last == entries.end() ? size : last->in_offset;
+  if (first->in_offset < 3 || in_end < first->in_offset || in_end > size)
+    throw std::invalid_argument("index does not match the input");
+
+  const char_type *in = (const char_type *)src;
+  const char_type *end = in + in_end;
+  range_sink sink(out, offset - first->out_offset, length);
+  decoder &dec = Context::Impl::get_decoder(ctx);
+  dec.start(sink, MAX_STRING, nullptr);
+  dec.write(in, 3);
+
+  /* Feed the input in 8 kB blocks to stop soon after the range is complete */
+  for (const char_type *p = in + first->in_offset; p < end && sink.missing() > 0;)
+  {
+    size_t n = std::min((size_t)(end - p), (size_t)8192);
+    dec.write(p, n);
+    dec.flush();
+    p += n;
+    if (p == end)
+      dec.finish();
+  }
+  if (sink.missing() > 0)
+    throw std::invalid_argument("index does not match the input");
+}
+
+void
+decompress_range(const void *src, size_t size, const Index &index, size_t offset,
+    size_t length, Sink &out)
+{
+  pooled_context ctx;
+  decompress_range(ctx.get(), src, size, index, offset, length, out);
+}
+
+size_t
+decompress_range(Context &ctx, const void *src, size_t size, const Index &index,
+    size_t offset, void *dst, size_t length)
+{
+  if (offset >= index.decompressed_size)
+    length = 0;
+  else
+    length = std::min(length, index.decompressed_size - offset);
+  memory_sink sink((char *)dst, length);
+  decompress_range(ctx, src, size, index, offset, length, sink);
+  return length;
+}
+
+size_t
+decompress_range(const void *src, size_t size, const Index &index, size_t offset,
+    void *dst, size_t length)
+{
+  pooled_context ctx;
+  return decompress_range(ctx.get(), src, size, index, offset, dst, length);
+}
+
+struct Compressor::Impl
+{
+  Impl(Sink &out, const CompressOptions &options)
+      : index(options.index)
+  {
+    if (options.stats)
+      *options.stats = Stats();
+    if (index)
+      indexed.reset(new index_sink(out));
+    enc.start(indexed ? *indexed : out, options, options.size_hint, options.stats);
+  }
+
+  encoder enc;
+  Index *index;
+  std::unique_ptr<index_sink> indexed; /* Wraps the sink if the index is requested */
+};
+
+Compressor::Compressor(Sink &out, const CompressOptions &options)
+    : impl(new Impl(out, options))
+{
+}
+
+Compressor::~Compressor() = default;
+
+void
+Compressor::feed(const void *data, size_t size)
+{
+  if (!impl)
+    throw std::logic_error("compressor has already been finished");
+  try
+  {
+    impl->enc.write((const char_type *)data, size);
+  }
+  catch (...)
+  {
+    impl.reset();
+    throw;
+  }
+}
+
+void
+Compressor::finish()
+{
+  if (!impl)
+    throw std::logic_error("compressor has already been finished");
+  std::unique_ptr<Impl> finished(std::move(impl));
+  finished->enc.finish();
+  if (finished->index)
+    *finished->index = finished->indexed->finish();
+}
+
+struct Decompressor::Impl
+{
+  Impl(Sink &out, const DecompressOptions &options)
+  {
+    if (options.stats)
+      *options.stats = Stats();
+    dec.start(out, options.write_size, options.stats);
+  }
+
+  decoder dec;
+};
+
+Decompressor::Decompressor(Sink &out, const DecompressOptions &options)
+    : impl(new Impl(out, options))
+{
+}
+
+Decompressor::~Decompressor() = default;
+
+void
+Decompressor::feed(const void *data, size_t size)
+{
+  if (!impl)
+    throw std::logic_error("decompressor has already been finished");
+  try
+  {
+    impl->dec.write((const char_type *)data, size);
+    impl->dec.flush();
+  }
+  catch (...)
+  {
+    impl.reset();
+    throw;
+  }
+}
+
+void
+Decompressor::finish()
+{
+  if (!impl)
+    throw std::logic_error("decompressor has already been finished");
+  std::unique_ptr<Impl> finished(std::move(impl));
+  finished->dec.finish();
 }
 
 void
@@ -1,4 +1,24 @@
 # noinspection PyUnresolvedReferences
-from .ncompress_core import compress, decompress
+from .ncompress_core import (
+    Compressor,
+    Decompressor,
+    Dictionary,
+    Index,
+    ResetPolicy,
+    Stats,
+    build_index,
+    compress,
+    compress_bound,
+    compress_fd,
+    compress_file,
+    compress_into,
+    compress_many,
+    decompress,
+    decompress_fd,
+    decompress_file,
+    decompress_into,
+    decompress_many,
+    decompress_range,
+)
 
 __version__ = "1.0.2"
@@ -0,0 +1,243 @@
+// Adapters between Python buffer-protocol objects and the ncompress API.
+// Written by Martin Valgur, released under Unlicense.
+//
+// Input data is read in place from any object supporting the buffer protocol (bytes,
+// bytearray, memoryview, mmap, numpy arrays, ...) and output is written directly into the
+// storage of the returned bytes object or a caller-supplied writable buffer, without
+// intermediate C++ buffers. Under the limited API (the stable-ABI wheels), a bytes object
+// can not be resized in place, so growing it and trimming it to the final size copy the
+// output into a new object.
+
+#pragma once
+
+#include <nanobind/nanobind.h>
+
+#include <bytesobject.h>
+#include <pyerrors.h>
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <vector>
+
+#include "ncompress.h"
+
+namespace pybuffer
+{
+
+namespace nb = nanobind;
+
+/// A read-only view of a C-contiguous Python buffer.
+struct buffer_view
+{
+  const char *data = nullptr;
+  size_t size = 0;
+};
+
+/// A view of a writable C-contiguous Python buffer.
+struct writable_buffer
+{
+  char *data = nullptr;
+  size_t size = 0;
+};
+
+/// Read-only views of the buffers of an iterable of Python objects, held until
+/// destruction.
+/** Must be constructed and destroyed with the GIL held. Throws TypeError if an item does
+    not support the buffer protocol.
+ */
+class buffer_list
+{
+  public:
+  explicit buffer_list(nb::handle items)
+  {
+    nb::object iter = nb::steal(PyObject_GetIter(items.ptr()));
+    if (!iter.is_valid())
+      throw nb::python_error();
+    try
+    {
+      for (;;)
+      {
+        nb::object item = nb::steal(PyIter_Next(iter.ptr()));
+        if (!item.is_valid())
+          break;
+        views.emplace_back();
+        if (PyObject_GetBuffer(item.ptr(), &views.back(), PyBUF_SIMPLE) != 0)
+        {
+          views.pop_back();
+          throw nb::python_error();
+        }
+        buffers.push_back({views.back().buf, (size_t)views.back().len});
+      }
+      if (PyErr_Occurred())
+        throw nb::python_error();
+    }
+    catch (...)
+    {
+      release();
+      throw;
+    }
+  }
+
+  ~buffer_list() { release(); }
+
+  buffer_list(const buffer_list &) = delete;
+  buffer_list &operator=(const buffer_list &) = delete;
+
+  const ncompress::Buffer *data() const { return buffers.data(); }
+  size_t size() const { return buffers.size(); }
+
+  /// Total size of the buffers in bytes.
+  size_t total_size() const
+  {
+    size_t total = 0;
+    for (const ncompress::Buffer &buffer : buffers)
+      total += buffer.size;
+    return total;
+  }
+
+  private:
+  std::deque<Py_buffer> views; // Not moved once acquired
+  std::vector<ncompress::Buffer> buffers;
+
+  void release()
+  {
+    for (Py_buffer &view : views)
+      PyBuffer_Release(&view);
+    views.clear();
+  }
+};
+
+/// A sink writing directly into the storage of a Python bytes object.
+/** The object is grown geometrically as needed and trimmed to size by release().
+    Growing re-acquires the GIL, so the sink can be used with the GIL released. Under the
+    limited API, both copy the output written so far into a new object.
+ */
+class bytes_sink : public ncompress::Sink
+{
+  public:
+  explicit bytes_sink(size_t initial_capacity)
+  {
+    bytes = PyBytes_FromStringAndSize(
+        nullptr, (Py_ssize_t)std::max<size_t>(initial_capacity, 64));
+    if (!bytes)
+      throw nb::python_error();
+    capacity = (size_t)PyBytes_Size(bytes);
+  }
+
+  ~bytes_sink() override
+  {
+    nb::gil_scoped_acquire gil;
+    Py_XDECREF(bytes);
+  }
+
+  void write(const char *data, size_t n) override
+  {
+    if (n > capacity - pos)
+    {
+      nb::gil_scoped_acquire gil;
+      resize(std::max(2 * capacity, pos + n));
+    }
+    memcpy(PyBytes_AsString(bytes) + pos, data, n);
+    pos += n;
+  }
+
+  /// Returns the bytes written so far and resets the sink. Must be called with the GIL
+  /// held.
+  nb::bytes release()
+  {
+    resize(pos);
+    PyObject *result = bytes;
+    bytes = nullptr;
+    capacity = pos = 0;
+    return nb::steal<nb::bytes>(result);
+  }
+
+  private:
+  PyObject *bytes = nullptr;
+  size_t capacity = 0;
+  size_t pos = 0;
+
+  void resize(size_t new_size)
+  {
+    if (new_size == capacity)
+      return;
+#ifndef Py_LIMITED_API
+    if (_PyBytes_Resize(&bytes, (Py_ssize_t)new_size) != 0)
+      throw nb::python_error();
+#else
+    PyObject *resized = PyBytes_FromStringAndSize(nullptr, (Py_ssize_t)new_size);
+    if (!resized)
+      throw nb::python_error();
+    memcpy(PyBytes_AsString(resized), PyBytes_AsString(bytes), std::min(pos, new_size));
+    Py_DECREF(bytes);
+    bytes = resized;
+#endif
+    capacity = new_size;
+  }
+};
+
+} // namespace pybuffer
+
+namespace nanobind::detail
+{
+
+template <> struct type_caster<pybuffer::buffer_view>
+{
+  NB_TYPE_CASTER(pybuffer::buffer_view, const_name("collections.abc.Buffer"));
+
+  type_caster() = default;
+  type_caster(const type_caster &) = delete;
+  type_caster &operator=(const type_caster &) = delete;
+  ~type_caster()
+  {
+    if (view.obj)
+      PyBuffer_Release(&view);
+  }
+
+  bool from_python(handle src, uint8_t, cleanup_list *) noexcept
+  {
+    if (PyObject_GetBuffer(src.ptr(), &view, PyBUF_SIMPLE) != 0)
+    {
+      PyErr_Clear();
+      return false;
+    }
+    value.data = (const char *)view.buf;
+    value.size = (size_t)view.len;
+    return true;
+  }
+
+  private:
+  Py_buffer view = {};
+};
+
+template <> struct type_caster<pybuffer::writable_buffer>
+{
+  NB_TYPE_CASTER(pybuffer::writable_buffer, const_name("collections.abc.Buffer"));
+
+  type_caster() = default;
+  type_caster(const type_caster &) = delete;
+  type_caster &operator=(const type_caster &) = delete;
+  ~type_caster()
+  {
+    if (view.obj)
+      PyBuffer_Release(&view);
+  }
+
+  bool from_python(handle src, uint8_t, cleanup_list *) noexcept
+  {
+    if (PyObject_GetBuffer(src.ptr(), &view, PyBUF_WRITABLE) != 0)
+    {
+      PyErr_Clear();
+      return false;
+    }
+    value.data = (char *)view.buf;
+    value.size = (size_t)view.len;
+    return true;
+  }
+
+  private:
+  Py_buffer view = {};
+};
+
+} // namespace nanobind::detail
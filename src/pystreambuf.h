@@ -96,6 +96,10 @@ namespace nb = nanobind;
     - Operations in C++ on mere files should be competitively fast compared
       to the direct use of \c std::fstream.
 
+    - The C++ code may run with the GIL released. Every call into the Python
+      file object re-acquires it, so the wrapped function is free to drop the
+      GIL around its own work.
+
 
     \b Motivation
 
@@ -155,7 +159,7 @@ class streambuf : public std::basic_streambuf<char>
   /** They are respectively used to buffer data read from and data written to
       the Python file object. It can be modified from Python.
   */
-  static const size_t default_buffer_size = 1024;
+  static const size_t default_buffer_size = 64 * 1024;
 
   /// Construct from a Python file object
   /** if buffer_size is 0 the current default_buffer_size is used.
@@ -210,6 +214,22 @@ class streambuf : public std::basic_streambuf<char>
     }
   }
 
+  /// Change the buffer size before any data has been transferred
+  /** buffer_size must not be 0.
+   */
+  void set_buffer_size(size_t buffer_size_)
+  {
+    buffer_size = buffer_size_;
+    if (py_tell.is_none())
+      pos_of_write_buffer_end_in_py_file = (off_type)buffer_size;
+    if (!py_write.is_none())
+    {
+      write_buffer.resize(buffer_size);
+      setp(write_buffer.data(), write_buffer.data() + buffer_size);
+      farthest_pptr = pptr();
+    }
+  }
+
   /// C.f. C++ standard section 27.5.2.4.3
   /** It is essential to override this virtual function for the stream
       member function readsome to work correctly (c.f. 27.6.1.3, alinea 30)
@@ -227,6 +247,7 @@ class streambuf : public std::basic_streambuf<char>
   int_type underflow() override
   {
     int_type const failure = traits_type::eof();
+    nb::gil_scoped_acquire gil;
     if (py_read.is_none())
     {
       throw std::invalid_argument("That Python file object has no 'read' attribute");
@@ -252,6 +273,7 @@ class streambuf : public std::basic_streambuf<char>
   /// C.f. C++ standard section 27.5.2.4.5
   int_type overflow(int_type c = traits_type::eof()) override
   {
+    nb::gil_scoped_acquire gil;
     if (py_write.is_none())
     {
       throw std::invalid_argument("That Python file object has no 'write' attribute");
@@ -285,6 +307,7 @@ class streambuf : public std::basic_streambuf<char>
   */
   int sync() override
   {
+    nb::gil_scoped_acquire gil;
     int result = 0;
     farthest_pptr = std::max(farthest_pptr, pptr());
     if (farthest_pptr && farthest_pptr > pbase())
@@ -320,6 +343,7 @@ class streambuf : public std::basic_streambuf<char>
        in a few places.
     */
     int const failure = off_type(-1);
+    nb::gil_scoped_acquire gil;
 
     if (py_seek.is_none())
     {
@@ -1,108 +1,647 @@
+#include <cstring>
 #include <istream>
-#include <sstream>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <stdexcept>
 #include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
 
 #include <nanobind/nanobind.h>
-
-#include <bytesobject.h>
-#include <pyerrors.h>
+#include <nanobind/stl/optional.h>
+#include <nanobind/stl/pair.h>
+#include <nanobind/stl/vector.h>
 
 #include "ncompress.h"
+#include "pybuffer.h"
 #include "pystreambuf.h"
 
 namespace nb = nanobind;
-using pystream::streambuf;
+using pybuffer::buffer_view;
+using pybuffer::writable_buffer;
+
+// Initial capacities of the returned bytes objects. The output grows geometrically from
+// there.
+static size_t
+compressed_size_estimate(size_t size)
+{
+  return size / 2 + 1024;
+}
+
+static size_t
+decompressed_size_estimate(size_t size)
+{
+  return size * 3 + 1024;
+}
+
+static const size_t unknown_size_estimate = 64 * 1024;
+
+// Initial capacity of the bytes object returned by compress(). The limited API can not
+// resize a bytes object in place, so there it starts at the worst-case size, which
+// leaves the final trim as the only copy of the output. The pages beyond the actual
+// output are never touched.
+static size_t
+compress_capacity(size_t size, const ncompress::CompressOptions &options)
+{
+#ifdef Py_LIMITED_API
+  return ncompress::compress_bound(size, options);
+#else
+  (void)options;
+  return compressed_size_estimate(size);
+#endif
+}
+
+static const ncompress::CompressOptions default_options;
+
+static const size_t default_buffer_size = default_options.read_size;
 
-// Unlike pybind11, nanobind doesn't provide a bytes <-> std::string type caster.
-namespace nanobind::detail
+static ncompress::CompressOptions
+compress_options(int max_bits, size_t size_hint = 0, int threads = 1,
+    size_t segment_size = default_options.segment_size, ncompress::Index *index = nullptr,
+    size_t buffer_size = default_buffer_size, ncompress::Stats *stats = nullptr,
+    const ncompress::ResetPolicy *reset_policy = nullptr,
+    ncompress::Dictionary dictionary = ncompress::Dictionary::hash)
 {
-template <> struct type_caster<std::string>
+  ncompress::CompressOptions options;
+  options.max_bits = max_bits;
+  options.dictionary = dictionary;
+  if (reset_policy)
+    options.reset_policy = *reset_policy;
+  options.size_hint = size_hint;
+  options.threads = threads;
+  options.segment_size = segment_size;
+  options.index = index;
+  options.stats = stats;
+  options.read_size = buffer_size;
+  options.write_size = buffer_size;
+  return options;
+}
+
+static ncompress::DecompressOptions
+decompress_options(int threads, const ncompress::Index *index,
+    size_t buffer_size = default_buffer_size, ncompress::Stats *stats = nullptr)
 {
-  NB_TYPE_CASTER(std::string, const_name("bytes"));
+  ncompress::DecompressOptions options;
+  options.threads = threads;
+  options.index = index;
+  options.stats = stats;
+  options.read_size = buffer_size;
+  options.write_size = buffer_size;
+  return options;
+}
 
-  bool from_python(handle src, uint8_t, cleanup_list *) noexcept
+// Sets the size of the read() and write() calls on the Python file object behind a
+// stream argument. Must be called before the stream is used.
+static void
+set_buffer_size(std::ios &stream, size_t buffer_size)
+{
+  if (buffer_size == 0 || buffer_size > ncompress::MAX_BUFFER_SIZE)
   {
-    if (!PyBytes_Check(src.ptr()))
-    {
-      PyErr_Clear();
-      return false;
-    }
-    char *str;
-    Py_ssize_t size;
-    PyBytes_AsStringAndSize(src.ptr(), &str, &size);
-    if (!str)
-    {
-      PyErr_Clear();
-      return false;
-    }
-    value = std::string(str, (size_t)size);
-    return true;
+    throw std::invalid_argument("buffer_size must be between 1 and " +
+        std::to_string(ncompress::MAX_BUFFER_SIZE));
   }
+  static_cast<pystream::streambuf *>(stream.rdbuf())->set_buffer_size(buffer_size);
+}
+
+// Converts a str, bytes or os.PathLike path to the file system encoding
+static std::string
+fs_path(nb::handle path)
+{
+  nb::object fspath = nb::steal(PyOS_FSPath(path.ptr()));
+  if (!fspath.is_valid())
+    throw nb::python_error();
+  nb::object encoded = PyBytes_Check(fspath.ptr())
+      ? fspath
+      : nb::steal(PyUnicode_EncodeFSDefault(fspath.ptr()));
+  if (!encoded.is_valid())
+    throw nb::python_error();
+  char *data;
+  Py_ssize_t size;
+  if (PyBytes_AsStringAndSize(encoded.ptr(), &data, &size) == -1)
+    throw nb::python_error();
+  if (memchr(data, 0, (size_t)size))
+    throw nb::value_error("embedded null byte");
+  return std::string(data, (size_t)size);
+}
+
+// Allocates a bytes object of the exact size for outputs whose size is known up front
+static nb::bytes
+new_bytes(size_t size)
+{
+  nb::bytes out =
+      nb::steal<nb::bytes>(PyBytes_FromStringAndSize(nullptr, (Py_ssize_t)size));
+  if (!out.ptr())
+    throw nb::python_error();
+  return out;
+}
+
+// Decompresses straight into a bytes object of the given size, which must match the size
+// of the decompressed data exactly.
+static nb::bytes
+decompress_sized(buffer_view data, size_t expected_size, int threads,
+    const ncompress::Index *index, ncompress::Stats *stats)
+{
+  nb::bytes out = new_bytes(expected_size);
+  size_t size;
+  try
+  {
+    nb::gil_scoped_release release;
+    size = ncompress::decompress(data.data, data.size, PyBytes_AsString(out.ptr()),
+        expected_size, decompress_options(threads, index, default_buffer_size, stats));
+  }
+  catch (const std::length_error &)
+  {
+    throw nb::value_error("data decompresses to more than expected_size bytes");
+  }
+  if (size != expected_size)
+    throw nb::value_error("data decompresses to fewer than expected_size bytes");
+  return out;
+}
+
+// Decompresses on multiple threads straight into a bytes object of the exact output size,
+// which the index pass determines up front.
+static nb::bytes
+decompress_parallel(
+    buffer_view data, int threads, const ncompress::Index *index, ncompress::Stats *stats)
+{
+  ncompress::Index built;
+  if (!index)
+  {
+    nb::gil_scoped_release release;
+    built = ncompress::build_index(data.data, data.size);
+    index = &built;
+  }
+  return decompress_sized(data, index->decompressed_size, threads, index, stats);
+}
+
+// Wraps ncompress::Compressor or ncompress::Decompressor for Python. The output produced
+// by each call is returned as a new bytes object.
+template <class Coder> class incremental
+{
+  public:
+  template <class... Args>
+  explicit incremental(const Args &...args)
+      : coder(sink, args...)
+  {
+  }
+
+  nb::bytes feed(buffer_view data, size_t size_estimate)
+  {
+    return run(size_estimate, [&] { coder.feed(data.data, data.size); });
+  }
+
+  nb::bytes finish() { return run(1024, [&] { coder.finish(); }); }
+
+  private:
+  // Forwards the output to the bytes object of the current call
+  struct forwarding_sink : public ncompress::Sink
+  {
+    ncompress::Sink *target = nullptr;
+    void write(const char *data, size_t size) override { target->write(data, size); }
+  };
+
+  std::mutex mutex; // Serializes concurrent calls from threads while the GIL is released
+  forwarding_sink sink;
+  Coder coder;
 
-  static handle from_cpp(const std::string &value, rv_policy, cleanup_list *) noexcept
+  template <class F> nb::bytes run(size_t size_estimate, F f)
   {
-    return PyBytes_FromStringAndSize(value.c_str(), value.size());
+    pybuffer::bytes_sink out(size_estimate);
+    {
+      nb::gil_scoped_release release;
+      std::lock_guard<std::mutex> lock(mutex);
+      sink.target = &out;
+      f();
+    }
+    return out.release();
   }
 };
-} // namespace nanobind::detail
 
+using py_compressor = incremental<ncompress::Compressor>;
+using py_decompressor = incremental<ncompress::Decompressor>;
+
+// All functions release the GIL for the duration of the LZW work so that Python threads
+// can compress and decompress in parallel. Arguments and return values are converted
+// while the GIL is still held and pystream::streambuf re-acquires it around calls into
+// Python file objects.
 NB_MODULE(ncompress_core, m)
 {
-  // io.BytesIO input-output
-  m.def("compress", ncompress::compress, nb::arg("in_stream"), nb::arg("out_stream"));
-  m.def("decompress", ncompress::decompress, nb::arg("in_stream"), nb::arg("out_stream"));
+  // Errors of system calls become OSError, e.g. FileNotFoundError
+  nb::register_exception_translator([](const std::exception_ptr &p, void *) {
+    try
+    {
+      std::rethrow_exception(p);
+    }
+    catch (const std::system_error &e)
+    {
+      if (e.code().category() != std::generic_category())
+        throw;
+      PyErr_SetObject(PyExc_OSError, nb::make_tuple(e.code().value(), e.what()).ptr());
+    }
+  });
+
+  // statistics
+  nb::class_<ncompress::Stats>(m, "Stats")
+      .def(nb::init<>())
+      .def_ro("bytes_in", &ncompress::Stats::bytes_in)
+      .def_ro("bytes_out", &ncompress::Stats::bytes_out)
+      .def_ro("codes", &ncompress::Stats::codes)
+      .def_ro("clears", &ncompress::Stats::clears)
+      .def_ro("width_changes", &ncompress::Stats::width_changes)
+      .def_ro("probes", &ncompress::Stats::probes)
+      .def_ro("seconds", &ncompress::Stats::seconds)
+      .def_ro("io_seconds", &ncompress::Stats::io_seconds);
+
+  // table reset policy
+  nb::class_<ncompress::ResetPolicy>(m, "ResetPolicy")
+      .def(
+          "__init__",
+          [](ncompress::ResetPolicy *self, size_t check_interval, double threshold,
+              size_t reset_interval) {
+            new (self) ncompress::ResetPolicy();
+            self->check_interval = check_interval;
+            self->threshold = threshold;
+            self->reset_interval = reset_interval;
+          },
+          nb::arg("check_interval") = default_options.reset_policy.check_interval,
+          nb::arg("threshold") = 0.0, nb::arg("reset_interval") = 0)
+      .def_rw("check_interval", &ncompress::ResetPolicy::check_interval)
+      .def_rw("threshold", &ncompress::ResetPolicy::threshold)
+      .def_rw("reset_interval", &ncompress::ResetPolicy::reset_interval);
+
+  // dictionary engines
+  nb::enum_<ncompress::Dictionary>(m, "Dictionary")
+      .value("hash", ncompress::Dictionary::hash)
+      .value("direct", ncompress::Dictionary::direct)
+      .value("bucketed", ncompress::Dictionary::bucketed);
+
+  // seekable access
+  nb::class_<ncompress::Index>(m, "Index")
+      .def(nb::init<>())
+      .def_ro("compressed_size", &ncompress::Index::compressed_size)
+      .def_ro("decompressed_size", &ncompress::Index::decompressed_size)
+      .def_prop_ro("entries",
+          [](const ncompress::Index &self) {
+            std::vector<std::pair<size_t, size_t>> entries;
+            entries.reserve(self.entries.size());
+            for (const ncompress::Index::Entry &entry : self.entries)
+              entries.emplace_back(entry.in_offset, entry.out_offset);
+            return entries;
+          })
+      .def("to_bytes",
+          [](const ncompress::Index &self) {
+            pybuffer::bytes_sink out(32 + 16 * self.entries.size());
+            ncompress::write_index(self, out);
+            return out.release();
+          })
+      .def_static(
+          "from_bytes",
+          [](buffer_view data) { return ncompress::read_index(data.data, data.size); },
+          nb::arg("data"));
+  m.def(
+      "build_index",
+      [](buffer_view data) {
+        nb::gil_scoped_release release;
+        return ncompress::build_index(data.data, data.size);
+      },
+      nb::arg("in_bytes"));
+  m.def(
+      "decompress_range",
+      [](buffer_view data, const ncompress::Index &index, size_t offset, size_t length) {
+        if (offset >= index.decompressed_size)
+          length = 0;
+        else
+          length = std::min(length, index.decompressed_size - offset);
+        nb::bytes out = new_bytes(length);
+        {
+          nb::gil_scoped_release release;
+          ncompress::decompress_range(
+              data.data, data.size, index, offset, PyBytes_AsString(out.ptr()), length);
+        }
+        return out;
+      },
+      nb::arg("in_bytes"), nb::arg("index"), nb::arg("offset"), nb::arg("length"));
 
-  // bytes input, io.BytesIO output
+  // buffer input, bytes output
   m.def(
       "compress",
-      [](const std::string &data, std::ostream &out) {
-        std::istringstream in(data);
-        ncompress::compress(in, out);
+      [](buffer_view data, int max_bits, int threads, size_t segment_size,
+          ncompress::Index *index, ncompress::Stats *stats,
+          const ncompress::ResetPolicy *reset_policy, ncompress::Dictionary dictionary) {
+        ncompress::CompressOptions options = compress_options(max_bits, 0, threads,
+            segment_size, index, default_buffer_size, stats, reset_policy, dictionary);
+        pybuffer::bytes_sink out(compress_capacity(data.size, options));
+        {
+          nb::gil_scoped_release release;
+          ncompress::compress(data.data, data.size, out, options);
+        }
+        return out.release();
       },
-      nb::arg("in_bytes"), nb::arg("out_stream"));
+      nb::arg("in_bytes"), nb::arg("max_bits") = ncompress::MAX_BITS,
+      nb::arg("threads") = 1, nb::arg("segment_size") = default_options.segment_size,
+      nb::arg("index").none() = nb::none(), nb::arg("stats").none() = nb::none(),
+      nb::arg("reset_policy").none() = nb::none(),
+      nb::arg("dictionary") = ncompress::Dictionary::hash);
   m.def(
       "decompress",
-      [](const std::string &data, std::ostream &out) {
-        std::istringstream in(data);
-        ncompress::decompress(in, out);
+      [](buffer_view data, int threads, const ncompress::Index *index,
+          std::optional<size_t> expected_size, ncompress::Stats *stats) {
+        if (!expected_size && index)
+          expected_size = index->decompressed_size;
+        if (expected_size)
+          return decompress_sized(data, *expected_size, threads, index, stats);
+        if (threads != 1)
+          return decompress_parallel(data, threads, index, stats);
+        pybuffer::bytes_sink out(decompressed_size_estimate(data.size));
+        {
+          nb::gil_scoped_release release;
+          ncompress::decompress(data.data, data.size, out,
+              decompress_options(1, nullptr, default_buffer_size, stats));
+        }
+        return out.release();
       },
-      nb::arg("in_bytes"), nb::arg("out_stream"));
+      nb::arg("in_bytes"), nb::arg("threads") = 1, nb::arg("index").none() = nb::none(),
+      nb::arg("expected_size").none() = nb::none(), nb::arg("stats").none() = nb::none());
+
+  // buffer input, io.BytesIO output
+  m.def(
+      "compress",
+      [](buffer_view data, std::ostream &out, int max_bits, int threads,
+          size_t segment_size, ncompress::Index *index, size_t buffer_size,
+          ncompress::Stats *stats, const ncompress::ResetPolicy *reset_policy,
+          ncompress::Dictionary dictionary) {
+        ncompress::CompressOptions options = compress_options(max_bits, 0, threads,
+            segment_size, index, buffer_size, stats, reset_policy, dictionary);
+        set_buffer_size(out, buffer_size);
+        nb::gil_scoped_release release;
+        ncompress::compress(data.data, data.size, out, options);
+      },
+      nb::arg("in_bytes"), nb::arg("out_stream"),
+      nb::arg("max_bits") = ncompress::MAX_BITS, nb::arg("threads") = 1,
+      nb::arg("segment_size") = default_options.segment_size,
+      nb::arg("index").none() = nb::none(), nb::arg("buffer_size") = default_buffer_size,
+      nb::arg("stats").none() = nb::none(), nb::arg("reset_policy").none() = nb::none(),
+      nb::arg("dictionary") = ncompress::Dictionary::hash);
+  m.def(
+      "decompress",
+      [](buffer_view data, std::ostream &out, int threads, const ncompress::Index *index,
+          size_t buffer_size, ncompress::Stats *stats) {
+        set_buffer_size(out, buffer_size);
+        nb::gil_scoped_release release;
+        ncompress::decompress(data.data, data.size, out,
+            decompress_options(threads, index, buffer_size, stats));
+      },
+      nb::arg("in_bytes"), nb::arg("out_stream"), nb::arg("threads") = 1,
+      nb::arg("index").none() = nb::none(), nb::arg("buffer_size") = default_buffer_size,
+      nb::arg("stats").none() = nb::none());
 
   // io.BytesIO input, bytes output
   m.def(
       "compress",
-      [](std::istream &in) -> std::string {
-        std::ostringstream out;
-        ncompress::compress(in, out);
-        return out.str();
+      [](std::istream &in, int max_bits, size_t size_hint, int threads,
+          size_t segment_size, ncompress::Index *index, size_t buffer_size,
+          ncompress::Stats *stats, const ncompress::ResetPolicy *reset_policy,
+          ncompress::Dictionary dictionary) {
+        ncompress::CompressOptions options = compress_options(max_bits, size_hint,
+            threads, segment_size, index, buffer_size, stats, reset_policy, dictionary);
+        set_buffer_size(in, buffer_size);
+        pybuffer::bytes_sink out(
+            size_hint ? compressed_size_estimate(size_hint) : unknown_size_estimate);
+        {
+          nb::gil_scoped_release release;
+          ncompress::compress(in, out, options);
+        }
+        return out.release();
       },
-      nb::arg("in_stream"));
+      nb::arg("in_stream"), nb::arg("max_bits") = ncompress::MAX_BITS,
+      nb::arg("size_hint") = 0, nb::arg("threads") = 1,
+      nb::arg("segment_size") = default_options.segment_size,
+      nb::arg("index").none() = nb::none(), nb::arg("buffer_size") = default_buffer_size,
+      nb::arg("stats").none() = nb::none(), nb::arg("reset_policy").none() = nb::none(),
+      nb::arg("dictionary") = ncompress::Dictionary::hash);
   m.def(
       "decompress",
-      [](std::istream &in) -> std::string {
-        std::ostringstream out;
-        ncompress::decompress(in, out);
-        return out.str();
+      [](std::istream &in, size_t buffer_size, ncompress::Stats *stats) {
+        set_buffer_size(in, buffer_size);
+        pybuffer::bytes_sink out(unknown_size_estimate);
+        {
+          nb::gil_scoped_release release;
+          ncompress::decompress(
+              in, out, decompress_options(1, nullptr, buffer_size, stats));
+        }
+        return out.release();
       },
-      nb::arg("in_stream"));
+      nb::arg("in_stream"), nb::arg("buffer_size") = default_buffer_size,
+      nb::arg("stats").none() = nb::none());
 
-  // bytes input-output
+  // io.BytesIO input-output
   m.def(
       "compress",
-      [](const std::string &data) -> std::string {
-        std::istringstream in(data);
-        std::ostringstream out;
-        ncompress::compress(in, out);
-        return out.str();
+      [](std::istream &in, std::ostream &out, int max_bits, size_t size_hint, int threads,
+          size_t segment_size, ncompress::Index *index, size_t buffer_size,
+          ncompress::Stats *stats, const ncompress::ResetPolicy *reset_policy,
+          ncompress::Dictionary dictionary) {
+        ncompress::CompressOptions options = compress_options(max_bits, size_hint,
+            threads, segment_size, index, buffer_size, stats, reset_policy, dictionary);
+        set_buffer_size(in, buffer_size);
+        set_buffer_size(out, buffer_size);
+        nb::gil_scoped_release release;
+        ncompress::compress(in, out, options);
       },
-      nb::arg("in_bytes"));
+      nb::arg("in_stream"), nb::arg("out_stream"),
+      nb::arg("max_bits") = ncompress::MAX_BITS, nb::arg("size_hint") = 0,
+      nb::arg("threads") = 1, nb::arg("segment_size") = default_options.segment_size,
+      nb::arg("index").none() = nb::none(), nb::arg("buffer_size") = default_buffer_size,
+      nb::arg("stats").none() = nb::none(), nb::arg("reset_policy").none() = nb::none(),
+      nb::arg("dictionary") = ncompress::Dictionary::hash);
   m.def(
       "decompress",
-      [](const std::string &data) -> std::string {
-        std::istringstream in(data);
-        std::ostringstream out;
-        ncompress::decompress(in, out);
-        return out.str();
+      [](std::istream &in, std::ostream &out, size_t buffer_size,
+          ncompress::Stats *stats) {
+        set_buffer_size(in, buffer_size);
+        set_buffer_size(out, buffer_size);
+        nb::gil_scoped_release release;
+        ncompress::decompress(
+            in, out, decompress_options(1, nullptr, buffer_size, stats));
       },
-      nb::arg("in_bytes"));
+      nb::arg("in_stream"), nb::arg("out_stream"),
+      nb::arg("buffer_size") = default_buffer_size, nb::arg("stats").none() = nb::none());
+
+  // buffer input, writable buffer output
+  m.def(
+      "compress_into",
+      [](buffer_view data, writable_buffer out_buffer, int max_bits, int threads,
+          size_t segment_size, ncompress::Index *index,
+          const ncompress::ResetPolicy *reset_policy, ncompress::Dictionary dictionary) {
+        ncompress::CompressOptions options = compress_options(max_bits, 0, threads,
+            segment_size, index, default_buffer_size, nullptr, reset_policy, dictionary);
+        nb::gil_scoped_release release;
+        return ncompress::compress(
+            data.data, data.size, out_buffer.data, out_buffer.size, options);
+      },
+      nb::arg("in_bytes"), nb::arg("out_buffer"),
+      nb::arg("max_bits") = ncompress::MAX_BITS, nb::arg("threads") = 1,
+      nb::arg("segment_size") = default_options.segment_size,
+      nb::arg("index").none() = nb::none(), nb::arg("reset_policy").none() = nb::none(),
+      nb::arg("dictionary") = ncompress::Dictionary::hash);
+  m.def(
+      "compress_bound",
+      [](size_t size, int max_bits, int threads, size_t segment_size,
+          const ncompress::ResetPolicy *reset_policy) {
+        return ncompress::compress_bound(size, compress_options(max_bits, 0, threads,
+            segment_size, nullptr, default_buffer_size, nullptr, reset_policy));
+      },
+      nb::arg("size"), nb::arg("max_bits") = ncompress::MAX_BITS, nb::arg("threads") = 1,
+      nb::arg("segment_size") = default_options.segment_size,
+      nb::arg("reset_policy").none() = nb::none());
+  m.def(
+      "decompress_into",
+      [](buffer_view data, writable_buffer out_buffer, int threads,
+          const ncompress::Index *index) {
+        nb::gil_scoped_release release;
+        return ncompress::decompress(data.data, data.size, out_buffer.data,
+            out_buffer.size, decompress_options(threads, index));
+      },
+      nb::arg("in_bytes"), nb::arg("out_buffer"), nb::arg("threads") = 1,
+      nb::arg("index").none() = nb::none());
+
+  // many small buffers, output concatenated with offsets
+  m.def(
+      "compress_many",
+      [](nb::iterable buffers, int max_bits, int threads,
+          ncompress::Dictionary dictionary) {
+        pybuffer::buffer_list inputs(buffers);
+        ncompress::CompressOptions options = compress_options(max_bits, 0, threads,
+            default_options.segment_size, nullptr, default_buffer_size, nullptr, nullptr,
+            dictionary);
+        pybuffer::bytes_sink out(
+            compressed_size_estimate(inputs.total_size()) + 4 * inputs.size());
+        std::vector<size_t> offsets;
+        {
+          nb::gil_scoped_release release;
+          offsets = ncompress::compress_many(inputs.data(), inputs.size(), out, options);
+        }
+        return std::make_pair(out.release(), std::move(offsets));
+      },
+      nb::arg("buffers"), nb::arg("max_bits") = ncompress::MAX_BITS,
+      nb::arg("threads") = 1, nb::arg("dictionary") = ncompress::Dictionary::hash);
+  m.def(
+      "decompress_many",
+      [](buffer_view data, const std::vector<size_t> &offsets, int threads) {
+        std::vector<ncompress::Buffer> inputs;
+        for (size_t i = 1; i < offsets.size(); ++i)
+        {
+          if (offsets[i] < offsets[i - 1] || offsets[i] > data.size)
+            throw nb::value_error("offsets must be ascending and within in_bytes");
+          inputs.push_back({data.data + offsets[i - 1], offsets[i] - offsets[i - 1]});
+        }
+        pybuffer::bytes_sink out(decompressed_size_estimate(data.size));
+        std::vector<size_t> out_offsets;
+        {
+          nb::gil_scoped_release release;
+          out_offsets = ncompress::decompress_many(
+              inputs.data(), inputs.size(), out, decompress_options(threads, nullptr));
+        }
+        return std::make_pair(out.release(), std::move(out_offsets));
+      },
+      nb::arg("in_bytes"), nb::arg("offsets"), nb::arg("threads") = 1);
+  m.def(
+      "decompress_many",
+      [](nb::iterable buffers, int threads) {
+        pybuffer::buffer_list inputs(buffers);
+        pybuffer::bytes_sink out(decompressed_size_estimate(inputs.total_size()));
+        std::vector<size_t> offsets;
+        {
+          nb::gil_scoped_release release;
+          offsets = ncompress::decompress_many(inputs.data(), inputs.size(), out,
+              decompress_options(threads, nullptr));
+        }
+        return std::make_pair(out.release(), std::move(offsets));
+      },
+      nb::arg("buffers"), nb::arg("threads") = 1);
+
+  // files and file descriptors
+  m.def(
+      "compress_file",
+      [](nb::object src, nb::object dst, int max_bits, int threads, size_t segment_size,
+          ncompress::Index *index, const ncompress::ResetPolicy *reset_policy,
+          ncompress::Dictionary dictionary) {
+        std::string src_path = fs_path(src);
+        std::string dst_path = fs_path(dst);
+        ncompress::CompressOptions options = compress_options(max_bits, 0, threads,
+            segment_size, index, default_buffer_size, nullptr, reset_policy, dictionary);
+        nb::gil_scoped_release release;
+        ncompress::compress_file(src_path, dst_path, options);
+      },
+      nb::arg("src_path"), nb::arg("dst_path"), nb::arg("max_bits") = ncompress::MAX_BITS,
+      nb::arg("threads") = 1, nb::arg("segment_size") = default_options.segment_size,
+      nb::arg("index").none() = nb::none(), nb::arg("reset_policy").none() = nb::none(),
+      nb::arg("dictionary") = ncompress::Dictionary::hash);
+  m.def(
+      "decompress_file",
+      [](nb::object src, nb::object dst, int threads, const ncompress::Index *index) {
+        std::string src_path = fs_path(src);
+        std::string dst_path = fs_path(dst);
+        ncompress::DecompressOptions options = decompress_options(threads, index);
+        nb::gil_scoped_release release;
+        ncompress::decompress_file(src_path, dst_path, options);
+      },
+      nb::arg("src_path"), nb::arg("dst_path"), nb::arg("threads") = 1,
+      nb::arg("index").none() = nb::none());
+  m.def(
+      "compress_fd",
+      [](int src_fd, int dst_fd, int max_bits, int threads, size_t segment_size,
+          ncompress::Index *index, const ncompress::ResetPolicy *reset_policy,
+          ncompress::Dictionary dictionary) {
+        ncompress::CompressOptions options = compress_options(max_bits, 0, threads,
+            segment_size, index, default_buffer_size, nullptr, reset_policy, dictionary);
+        nb::gil_scoped_release release;
+        ncompress::compress_fd(src_fd, dst_fd, options);
+      },
+      nb::arg("src_fd"), nb::arg("dst_fd"), nb::arg("max_bits") = ncompress::MAX_BITS,
+      nb::arg("threads") = 1, nb::arg("segment_size") = default_options.segment_size,
+      nb::arg("index").none() = nb::none(), nb::arg("reset_policy").none() = nb::none(),
+      nb::arg("dictionary") = ncompress::Dictionary::hash);
+  m.def(
+      "decompress_fd",
+      [](int src_fd, int dst_fd, int threads, const ncompress::Index *index) {
+        nb::gil_scoped_release release;
+        ncompress::decompress_fd(src_fd, dst_fd, decompress_options(threads, index));
+      },
+      nb::arg("src_fd"), nb::arg("dst_fd"), nb::arg("threads") = 1,
+      nb::arg("index").none() = nb::none());
+
+  // incremental compression and decompression
+  nb::class_<py_compressor>(m, "Compressor")
+      .def(
+          "__init__",
+          [](py_compressor *self, int max_bits, size_t size_hint, ncompress::Index *index,
+              const ncompress::ResetPolicy *reset_policy,
+              ncompress::Dictionary dictionary) {
+            new (self) py_compressor(compress_options(max_bits, size_hint, 1,
+                default_options.segment_size, index, default_buffer_size, nullptr,
+                reset_policy, dictionary));
+          },
+          nb::arg("max_bits") = ncompress::MAX_BITS, nb::arg("size_hint") = 0,
+          nb::arg("index").none() = nb::none(),
+          nb::arg("reset_policy").none() = nb::none(),
+          nb::arg("dictionary") = ncompress::Dictionary::hash, nb::keep_alive<1, 4>())
+      .def(
+          "feed",
+          [](py_compressor &self, buffer_view data) {
+            return self.feed(data, compressed_size_estimate(data.size));
+          },
+          nb::arg("in_bytes"))
+      .def("finish", &py_compressor::finish);
+  nb::class_<py_decompressor>(m, "Decompressor")
+      .def(nb::init<>())
+      .def(
+          "feed",
+          [](py_decompressor &self, buffer_view data) {
+            return self.feed(data, decompressed_size_estimate(data.size));
+          },
+          nb::arg("in_bytes"))
+      .def("finish", &py_decompressor::finish);
 }
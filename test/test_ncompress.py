@@ -1,9 +1,31 @@
+import os
+import random
 import shutil
 import subprocess
 from io import BytesIO
 
 import pytest
-from ncompress import compress, decompress
+from ncompress import (
+    Compressor,
+    Decompressor,
+    Dictionary,
+    Index,
+    ResetPolicy,
+    Stats,
+    build_index,
+    compress,
+    compress_bound,
+    compress_fd,
+    compress_file,
+    compress_into,
+    compress_many,
+    decompress,
+    decompress_fd,
+    decompress_file,
+    decompress_into,
+    decompress_many,
+    decompress_range,
+)
 
 
 @pytest.fixture
@@ -57,6 +79,427 @@ def test_stream_string(sample_data, sample_compressed):
     assert decompress(BytesIO(sample_compressed)) == sample_data
 
 
+@pytest.mark.parametrize("buffer_type",
+                         [bytearray, memoryview, lambda x: memoryview(x)[::1]],
+                         ids=["bytearray", "memoryview", "memoryview_slice"])
+def test_buffer_input(sample_data, sample_compressed, buffer_type):
+    assert compress(buffer_type(sample_data)) == sample_compressed
+    assert decompress(buffer_type(sample_compressed)) == sample_data
+
+    out = BytesIO()
+    compress(buffer_type(sample_data), out)
+    assert out.getvalue() == sample_compressed
+
+
+def test_mmap_input(tmp_path, sample_data, sample_compressed):
+    import mmap
+
+    path = tmp_path / "sample.Z"
+    path.write_bytes(sample_compressed)
+    with open(path, "rb") as f, mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ) as mm:
+        assert decompress(mm) == sample_data
+
+
+def test_non_contiguous_input(sample_data):
+    with pytest.raises(TypeError):
+        compress(memoryview(sample_data)[::2])
+
+
+def test_large_output():
+    data = bytes(range(256)) * 20000
+    assert decompress(compress(data)) == data
+    assert decompress(compress(b"\0" * 10_000_000)) == b"\0" * 10_000_000
+
+
+def test_into(sample_data, sample_compressed):
+    out = bytearray(len(sample_compressed) + 10)
+    n = compress_into(sample_data, out)
+    assert n == len(sample_compressed)
+    assert out[:n] == sample_compressed
+
+    out = bytearray(len(sample_data))
+    assert decompress_into(sample_compressed, memoryview(out)) == len(sample_data)
+    assert out == sample_data
+
+    with pytest.raises(ValueError, match="output buffer is too small"):
+        compress_into(sample_data, bytearray(len(sample_compressed) - 1))
+    with pytest.raises(ValueError, match="output buffer is too small"):
+        decompress_into(sample_compressed, bytearray(len(sample_data) - 1))
+    with pytest.raises(TypeError):
+        decompress_into(sample_compressed, bytes(len(sample_data)))
+
+
+@pytest.mark.parametrize("threads", [1, 2])
+def test_into_leaves_tail(threads):
+    # Short repeated strings, which the decoder copies in whole words
+    data = b"a" * 1000 + b"abcabcabd" * 500
+    compressed = compress(data, threads=threads, segment_size=2000)
+    for extra in [1, 15, 16, 64]:
+        out = bytearray(b"\xa5" * (len(data) + extra))
+        assert decompress_into(compressed, out, threads=threads) == len(data)
+        assert out[:len(data)] == data
+        assert out[len(data):] == b"\xa5" * extra
+
+
+@pytest.mark.parametrize("max_bits", [9, 16])
+@pytest.mark.parametrize("threads", [1, 2])
+def test_compress_bound(max_bits, threads):
+    rng = random.Random(0)
+    for size in [0, 1, 100, 100000]:
+        data = bytes(rng.randrange(256) for _ in range(size))
+        bound = compress_bound(size, max_bits=max_bits, threads=threads, segment_size=1000)
+        out = bytearray(bound)
+        n = compress_into(data, out, max_bits=max_bits, threads=threads, segment_size=1000)
+        assert n <= bound
+        assert out[:n] == compress(data, max_bits=max_bits, threads=threads, segment_size=1000)
+    assert compress_bound(1000, threads=2, segment_size=1) > compress_bound(1000)
+    with pytest.raises(ValueError):
+        compress_bound(1000, max_bits=17)
+
+
+@pytest.mark.parametrize("chunk_size", [1, 7, 1000])
+def test_incremental(sample_data, chunk_size):
+    data = sample_data * 100 + bytes(range(256)) * 10
+    compressed = compress(data)
+
+    c = Compressor()
+    out = [c.feed(data[i:i + chunk_size]) for i in range(0, len(data), chunk_size)]
+    out.append(c.finish())
+    assert b"".join(out) == compressed
+
+    d = Decompressor()
+    out = [d.feed(memoryview(compressed)[i:i + chunk_size])
+           for i in range(0, len(compressed), chunk_size)]
+    assert len(b"".join(out)) > len(data) // 2
+    out.append(d.finish())
+    assert b"".join(out) == data
+
+
+def test_incremental_errors(sample_compressed):
+    c = Compressor()
+    assert c.finish() == compress(b"")
+    with pytest.raises(RuntimeError):
+        c.feed(b"abc")
+    with pytest.raises(RuntimeError):
+        c.finish()
+
+    d = Decompressor()
+    d.feed(b"1")
+    with pytest.raises(ValueError, match="not in LZW-compressed format"):
+        d.feed(sample_compressed)
+    with pytest.raises(RuntimeError):
+        d.feed(sample_compressed)
+
+    with pytest.raises(ValueError, match="input stream is empty"):
+        Decompressor().finish()
+
+
+def test_nested_calls(sample_data):
+    data = sample_data * 1000
+
+    class NestedWriter(BytesIO):
+        def write(self, b):
+            assert decompress(compress(b)) == b
+            return super().write(b)
+
+    out = NestedWriter()
+    compress(data, out)
+    assert decompress(out.getvalue()) == data
+
+    out = NestedWriter()
+    decompress(compress(data), out)
+    assert out.getvalue() == data
+
+
+@pytest.mark.parametrize("max_bits", [9, 12, 16])
+def test_max_bits(max_bits):
+    data = bytes(range(256)) * 50 + b"abcd" * 10000 + bytes(range(0, 256, 3)) * 100
+    compressed = compress(data, max_bits=max_bits)
+    assert compressed[2] == 0x80 | max_bits
+    assert decompress(compressed) == data
+
+    compress_cmd = shutil.which("compress")
+    if compress_cmd:
+        assert compressed == subprocess.check_output([compress_cmd, f"-b{max_bits}"], input=data)
+
+    out = BytesIO()
+    compress(BytesIO(data), out, max_bits=max_bits)
+    assert out.getvalue() == compressed
+
+    c = Compressor(max_bits=max_bits)
+    assert c.feed(data) + c.finish() == compressed
+
+    out = bytearray(len(compressed))
+    assert compress_into(data, out, max_bits=max_bits) == len(compressed)
+    assert out == compressed
+
+
+@pytest.mark.parametrize("max_bits", [8, 17])
+def test_invalid_max_bits(max_bits):
+    with pytest.raises(ValueError, match="max_bits must be between 9 and 16"):
+        compress(b"abc", max_bits=max_bits)
+    with pytest.raises(ValueError, match="max_bits must be between 9 and 16"):
+        Compressor(max_bits=max_bits)
+
+
+def test_reset_policy():
+    rng = random.Random(0)
+    text = b" ".join(rng.choice([b"lorem", b"ipsum", b"dolor", b"sit", b"amet"]) for _ in range(20000))
+    data = text + bytes(rng.randrange(256) for _ in range(50000)) + text
+    assert compress(data, reset_policy=ResetPolicy()) == compress(data)
+
+    for policy in [
+        ResetPolicy(check_interval=0),
+        ResetPolicy(check_interval=1),
+        ResetPolicy(threshold=0.5),
+        ResetPolicy(reset_interval=1),
+        ResetPolicy(check_interval=100, threshold=0.1, reset_interval=5000),
+    ]:
+        stats = Stats()
+        compressed = compress(data, max_bits=12, reset_policy=policy, stats=stats)
+        assert decompress(compressed) == data
+        if policy.check_interval == 0:
+            assert stats.clears == 0
+        if policy.reset_interval:
+            assert stats.clears >= len(data) // policy.reset_interval // 10
+        assert len(compressed) <= compress_bound(len(data), max_bits=12, reset_policy=policy)
+        c = Compressor(max_bits=12, reset_policy=policy)
+        assert b"".join(c.feed(data[i:i + 777]) for i in range(0, len(data), 777)) + c.finish() == compressed
+        assert compress(BytesIO(data), max_bits=12, reset_policy=policy) == compressed
+
+    policy = ResetPolicy(reset_interval=1000)
+    assert policy.check_interval == 10000 and policy.threshold == 0
+    policy.threshold = 1.0
+    with pytest.raises(ValueError, match="threshold"):
+        compress(data, reset_policy=policy)
+
+
+@pytest.mark.parametrize("max_bits", [9, 12])
+def test_dictionary(max_bits):
+    rng = random.Random(0)
+    text = b" ".join(rng.choice([b"lorem", b"ipsum", b"dolor", b"sit", b"amet"]) for _ in range(20000))
+    data = text + bytes(rng.randrange(256) for _ in range(50000)) + text
+    compressed = compress(data, max_bits=max_bits)
+
+    assert compress(data, max_bits=max_bits, dictionary=Dictionary.direct) == compressed
+    assert compress(BytesIO(data), max_bits=max_bits, dictionary=Dictionary.direct) == compressed
+    c = Compressor(max_bits=max_bits, dictionary=Dictionary.direct)
+    assert b"".join(c.feed(data[i:i + 777]) for i in range(0, len(data), 777)) + c.finish() == compressed
+    records = [data[i:i + 100] for i in range(0, 20000, 100)]
+    assert (compress_many(records, max_bits=max_bits, dictionary=Dictionary.direct) ==
+            compress_many(records, max_bits=max_bits))
+
+    with pytest.raises(ValueError, match="max_bits"):
+        compress(data, max_bits=13, dictionary=Dictionary.direct)
+
+
+@pytest.mark.parametrize("max_bits", [9, 12, 16])
+def test_dictionary_bucketed(max_bits):
+    rng = random.Random(1)
+    data = bytes(rng.randrange(256) for _ in range(200000)) + b"abcdefgh" * 20000
+    compressed = compress(data, max_bits=max_bits)
+
+    assert compress(data, max_bits=max_bits, dictionary=Dictionary.bucketed) == compressed
+    # Streams without a size are compressed with a growing table
+    assert compress(BytesIO(data), max_bits=max_bits, size_hint=1000,
+                    dictionary=Dictionary.bucketed) == compressed
+    c = Compressor(max_bits=max_bits, size_hint=1000, dictionary=Dictionary.bucketed)
+    assert b"".join(c.feed(data[i:i + 4096]) for i in range(0, len(data), 4096)) + c.finish() == compressed
+
+
+@pytest.mark.parametrize("size_hint", [0, 1, 1000, 10**9])
+def test_size_hint(size_hint):
+    data = bytes(range(256)) * 50 + b"abcd" * 10000 + bytes(range(0, 256, 3)) * 100
+    compressed = compress(data)
+
+    assert compress(BytesIO(data), size_hint=size_hint) == compressed
+
+    out = BytesIO()
+    compress(BytesIO(data), out, size_hint=size_hint)
+    assert out.getvalue() == compressed
+
+    c = Compressor(size_hint=size_hint)
+    out = b"".join(c.feed(data[i:i + 1000]) for i in range(0, len(data), 1000))
+    assert out + c.finish() == compressed
+
+
+@pytest.mark.parametrize("buffer_size", [1, 1000, 1 << 20])
+def test_buffer_size(buffer_size):
+    data = bytes(range(256)) * 50 + b"abcd" * 10000 + bytes(range(0, 256, 3)) * 100
+    compressed = compress(data)
+
+    class RecordingIO(BytesIO):
+        def read(self, size=-1):
+            sizes.append(size)
+            return super().read(size)
+
+    sizes = []
+    assert compress(RecordingIO(data), buffer_size=buffer_size) == compressed
+    assert set(sizes) == {buffer_size}
+    sizes = []
+    assert decompress(RecordingIO(compressed), buffer_size=buffer_size) == data
+    assert set(sizes) == {buffer_size}
+
+    out = BytesIO()
+    compress(BytesIO(data), out, buffer_size=buffer_size)
+    assert out.getvalue() == compressed
+    out = BytesIO()
+    decompress(compressed, out, buffer_size=buffer_size)
+    assert out.getvalue() == data
+
+
+def test_invalid_buffer_size():
+    with pytest.raises(ValueError, match="buffer_size must be between 1 and"):
+        compress(BytesIO(b"abc"), buffer_size=0)
+    with pytest.raises(ValueError, match="buffer_size must be between 1 and"):
+        decompress(compress(b"abc"), BytesIO(), buffer_size=0)
+    with pytest.raises(ValueError, match="buffer_size must be between 1 and"):
+        compress(b"abc", BytesIO(), buffer_size=1 << 40)
+    with pytest.raises(ValueError, match="buffer_size must be between 1 and"):
+        decompress(BytesIO(compress(b"abc")), buffer_size=1 << 40)
+
+
+@pytest.mark.parametrize("segment_size", [1, 1000, 100000])
+def test_parallel(segment_size):
+    data = bytes(range(256)) * 50 + b"abcd" * 10000 + bytes(range(0, 256, 3)) * 100
+    compressed = compress(data, threads=2, segment_size=segment_size)
+    assert decompress(compressed) == data
+    if segment_size >= len(data):
+        assert compressed == compress(data)
+
+    uncompress_cmd = shutil.which("uncompress")
+    if uncompress_cmd:
+        assert subprocess.check_output([uncompress_cmd, "-c"], input=compressed) == data
+
+    assert compress(data, threads=0, segment_size=segment_size) == compressed
+    assert compress(BytesIO(data), threads=3, segment_size=segment_size) == compressed
+    out = bytearray(len(compressed))
+    assert compress_into(data, out, threads=4, segment_size=segment_size) == len(compressed)
+    assert out == compressed
+
+
+@pytest.mark.parametrize("segment_size", [1000, 100000])
+def test_parallel_decompress(segment_size):
+    data = bytes(range(256)) * 50 + b"abcd" * 10000 + bytes(range(0, 256, 3)) * 100
+    for compressed in [compress(data, threads=2, segment_size=segment_size), compress(data)]:
+        assert decompress(compressed, threads=2) == data
+        assert decompress(compressed, threads=0) == data
+        out = BytesIO()
+        decompress(compressed, out, threads=3)
+        assert out.getvalue() == data
+        out = bytearray(len(data))
+        assert decompress_into(compressed, out, threads=4) == len(data)
+        assert out == data
+        with pytest.raises(ValueError):
+            decompress_into(compressed, bytearray(len(data) - 1), threads=2)
+        with pytest.raises(ValueError):
+            decompress(compressed[:-1] + b"\xff", threads=2)
+
+
+@pytest.mark.parametrize("threads", [1, 2])
+def test_expected_size(threads):
+    data = bytes(range(256)) * 50 + b"abcd" * 10000 + bytes(range(0, 256, 3)) * 100
+    compressed = compress(data, threads=2, segment_size=10000)
+    assert decompress(compressed, threads=threads, expected_size=len(data)) == data
+    assert decompress(compress(b""), threads=threads, expected_size=0) == b""
+    with pytest.raises(ValueError, match="more than expected_size"):
+        decompress(compressed, threads=threads, expected_size=len(data) - 1)
+    with pytest.raises(ValueError, match="fewer than expected_size"):
+        decompress(compressed, threads=threads, expected_size=len(data) + 1)
+
+    index = build_index(compressed)
+    assert decompress(compressed, threads=threads, index=index) == data
+
+
+@pytest.mark.parametrize("threads", [1, 2])
+def test_index(threads):
+    data = bytes(range(256)) * 50 + b"abcd" * 10000 + bytes(range(0, 256, 3)) * 100
+    index = Index()
+    compressed = compress(data, threads=threads, segment_size=3000, index=index)
+    assert index.compressed_size == len(compressed)
+    assert index.decompressed_size == len(data)
+    assert index.entries[0] == (3, 0)
+    if threads > 1:
+        assert [out for _, out in index.entries] == list(range(0, len(data), 3000))
+
+    scanned = build_index(compressed)
+    assert scanned.entries == index.entries
+    assert scanned.decompressed_size == index.decompressed_size
+
+    streamed = Index()
+    assert compress(BytesIO(data), threads=threads, segment_size=3000, index=streamed) == compressed
+    assert streamed.entries == index.entries
+    incremental = Index()
+    c = Compressor(index=incremental)
+    assert c.feed(data) + c.finish() == compress(data)
+    assert incremental.entries == build_index(compress(data)).entries
+
+    restored = Index.from_bytes(index.to_bytes())
+    assert restored.entries == index.entries
+    assert restored.compressed_size == index.compressed_size
+    assert restored.decompressed_size == index.decompressed_size
+    assert decompress(compressed, threads=2, index=restored) == data
+
+
+@pytest.mark.parametrize("threads", [1, 2])
+def test_stats(threads):
+    data = bytes(range(256)) * 50 + b"abcd" * 10000 + bytes(range(0, 256, 3)) * 100
+    stats = Stats()
+    compressed = compress(data, threads=threads, segment_size=3000, stats=stats)
+    assert stats.bytes_in == len(data)
+    assert stats.bytes_out == len(compressed)
+    assert 0 < stats.codes < len(data)
+    assert stats.probes >= stats.codes
+    assert stats.width_changes > 0
+    if threads > 1:
+        assert stats.clears == len(data) // 3000
+    assert 0 <= stats.io_seconds <= stats.seconds
+
+    streamed = Stats()
+    assert compress(BytesIO(data), threads=threads, segment_size=3000, stats=streamed) == compressed
+    assert (streamed.codes, streamed.clears, streamed.probes) == (stats.codes, stats.clears, stats.probes)
+
+    for args in [{"threads": threads}, {"expected_size": len(data)}, {}]:
+        decompressed = Stats()
+        assert decompress(compressed, stats=decompressed, **args) == data
+        assert decompressed.bytes_in == len(compressed)
+        assert decompressed.bytes_out == len(data)
+        assert decompressed.codes == stats.codes
+        assert decompressed.clears == stats.clears
+    out = BytesIO()
+    decompress(BytesIO(compressed), out, stats=decompressed)
+    assert decompressed.bytes_out == len(data)
+    assert decompressed.codes == stats.codes
+
+
+def test_decompress_range():
+    data = bytes(range(256)) * 50 + b"abcd" * 10000 + bytes(range(0, 256, 3)) * 100
+    index = Index()
+    compressed = compress(data, threads=2, segment_size=3000, index=index)
+    for offset, length in [(0, 10), (2999, 2), (3000, 3000), (12345, 20000), (len(data) - 5, 100),
+                           (len(data), 10), (0, len(data)), (100, 0)]:
+        assert decompress_range(compressed, index, offset, length) == data[offset:offset + length]
+
+    with pytest.raises(ValueError, match="index does not match the input"):
+        decompress_range(compressed[:-1], index, 0, 10)
+    with pytest.raises(ValueError, match="not an LZW index"):
+        Index.from_bytes(b"abc")
+    with pytest.raises(ValueError, match="truncated"):
+        Index.from_bytes(index.to_bytes()[:-1])
+
+
+def test_invalid_parallel_options():
+    with pytest.raises(ValueError, match="threads must not be negative"):
+        compress(b"abc", threads=-1)
+    with pytest.raises(ValueError, match="segment_size must be positive"):
+        compress(b"abc", threads=2, segment_size=0)
+    with pytest.raises(ValueError, match="segment_size is too large"):
+        compress(BytesIO(b"abc"), threads=2, segment_size=2**63)
+    assert compress(BytesIO(b"abc"), threads=2, segment_size=2**40) == compress(b"abc")
+    with pytest.raises(ValueError, match="threads must not be negative"):
+        decompress(compress(b"abc"), threads=-1)
+
+
 def test_empty_input(sample_data):
     assert decompress(compress(b"")) == b""
     with pytest.raises(ValueError):
@@ -113,3 +556,138 @@ def test_file_input():
         expected = f.read()
         f.seek(0)
         assert decompress(compress(f)) == expected
+
+
+@pytest.mark.parametrize("threads", [1, 2])
+def test_compress_file(tmp_path, threads):
+    data = bytes(range(256)) * 50 + b"abcd" * 10000 + bytes(range(0, 256, 3)) * 100
+    (tmp_path / "data").write_bytes(data)
+    compress_file(tmp_path / "data", tmp_path / "data.Z", threads=threads, segment_size=10000)
+    compressed = (tmp_path / "data.Z").read_bytes()
+    assert compressed == compress(data, threads=threads, segment_size=10000)
+    decompress_file(str(tmp_path / "data.Z"), str(tmp_path / "out"), threads=threads)
+    assert (tmp_path / "out").read_bytes() == data
+
+
+def test_compress_fd(tmp_path):
+    data = bytes(range(256)) * 4
+    read_fd, write_fd = os.pipe()
+    os.write(write_fd, data)
+    os.close(write_fd)
+    with open(tmp_path / "data.Z", "wb") as f:
+        compress_fd(read_fd, f.fileno())
+    os.close(read_fd)
+    assert (tmp_path / "data.Z").read_bytes() == compress(data)
+
+    with open(tmp_path / "data.Z", "rb") as fin, open(tmp_path / "out", "wb") as fout:
+        decompress_fd(fin.fileno(), fout.fileno())
+    assert (tmp_path / "out").read_bytes() == data
+
+
+@pytest.mark.parametrize("threads", [0, 2])
+def test_compress_fd_pipe_threads(tmp_path, threads):
+    from concurrent.futures import ThreadPoolExecutor
+
+    data = bytes(range(256)) * 50 + b"abcd" * 10000 + bytes(range(0, 256, 3)) * 100
+    read_fd, write_fd = os.pipe()
+    with ThreadPoolExecutor(1) as pool:
+        writer = pool.submit(lambda: (os.write(write_fd, data), os.close(write_fd)))
+        with open(tmp_path / "data.Z", "wb") as f:
+            compress_fd(read_fd, f.fileno(), threads=threads, segment_size=10000)
+        writer.result()
+    os.close(read_fd)
+    assert (tmp_path / "data.Z").read_bytes() == compress(data, threads=threads,
+                                                          segment_size=10000)
+
+
+def test_compress_file_errors(tmp_path):
+    with pytest.raises(FileNotFoundError):
+        compress_file(tmp_path / "missing", tmp_path / "out")
+    (tmp_path / "data").write_bytes(b"not compressed")
+    with pytest.raises(ValueError, match="not in LZW-compressed format"):
+        decompress_file(tmp_path / "data", tmp_path / "out")
+    assert not (tmp_path / "out").exists()
+    (tmp_path / "out").write_bytes(b"existing")
+    with pytest.raises(ValueError, match="not in LZW-compressed format"):
+        decompress_file(tmp_path / "data", tmp_path / "out")
+    assert (tmp_path / "out").read_bytes() == b"existing"
+    assert sorted(path.name for path in tmp_path.iterdir()) == ["data", "out"]
+    with pytest.raises(ValueError, match="same file"):
+        compress_file(tmp_path / "data", tmp_path / "data")
+    assert (tmp_path / "data").read_bytes() == b"not compressed"
+
+
+@pytest.mark.skipif(not hasattr(os, "mkfifo"), reason="needs device files and FIFOs")
+def test_compress_file_special_output(tmp_path):
+    from concurrent.futures import ThreadPoolExecutor
+
+    data = bytes(range(256)) * 100
+    (tmp_path / "data").write_bytes(data)
+    (tmp_path / "data.Z").write_bytes(compress(data))
+    compress_file(tmp_path / "data", os.devnull)
+    decompress_file(tmp_path / "data.Z", os.devnull)
+    with pytest.raises(ValueError, match="not in LZW-compressed format"):
+        decompress_file(tmp_path / "data", os.devnull)
+    assert os.path.exists(os.devnull)
+
+    fifo = tmp_path / "fifo"
+    os.mkfifo(fifo)
+    with ThreadPoolExecutor(1) as pool:
+        reader = pool.submit(lambda: fifo.read_bytes())
+        compress_file(tmp_path / "data", fifo)
+        assert reader.result() == compress(data)
+        reader = pool.submit(lambda: fifo.read_bytes())
+        with pytest.raises(ValueError, match="not in LZW-compressed format"):
+            decompress_file(tmp_path / "data", fifo)
+        assert reader.result() == b""
+    assert fifo.is_fifo()
+
+
+@pytest.mark.parametrize("threads", [1, 2])
+def test_many(sample_data, threads):
+    records = [sample_data[:i] * (i % 7) for i in range(200)] + [bytearray(b"abc" * 10000)]
+    data, offsets = compress_many(records, max_bits=12, threads=threads)
+    assert len(offsets) == len(records) + 1
+    compressed = [data[offsets[i]:offsets[i + 1]] for i in range(len(records))]
+    assert compressed == [compress(record, max_bits=12) for record in records]
+
+    for out, out_offsets in [decompress_many(compressed, threads=threads),
+                             decompress_many(memoryview(data), offsets, threads=threads)]:
+        assert out_offsets[-1] == len(out)
+        assert [out[out_offsets[i]:out_offsets[i + 1]] for i in range(len(records))] == records
+
+    assert compress_many([]) == (b"", [0])
+    assert decompress_many(b"", [0]) == (b"", [0])
+
+
+def test_many_errors(sample_compressed):
+    with pytest.raises(ValueError, match="input 1: not in LZW-compressed format"):
+        decompress_many([sample_compressed, b"xyz", sample_compressed])
+    with pytest.raises(ValueError, match="offsets"):
+        decompress_many(sample_compressed, [0, len(sample_compressed) + 1])
+    with pytest.raises(ValueError, match="offsets"):
+        decompress_many(sample_compressed, [2, 1])
+    with pytest.raises(TypeError):
+        compress_many([b"abc", 1])
+    with pytest.raises(ValueError):
+        compress_many([b"abc"], max_bits=8)
+
+
+def test_threads(sample_data):
+    from concurrent.futures import ThreadPoolExecutor
+
+    data = sample_data * 1000 + bytes(range(256)) * 100
+    compressed = compress(data)
+
+    def roundtrip(i):
+        if i % 2:
+            out = BytesIO()
+            compress(BytesIO(data), out)
+            assert out.getvalue() == compressed
+            return decompress(BytesIO(compressed))
+        assert compress(data) == compressed
+        return decompress(compressed)
+
+    with ThreadPoolExecutor(max_workers=8) as pool:
+        for result in pool.map(roundtrip, range(32)):
+            assert result == data